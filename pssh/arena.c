@@ -0,0 +1,102 @@
+/* Bump allocator.
+ *
+ * An arena is a chain of blocks; the first block holds the Arena
+ * header itself, so an arena sized correctly up front costs exactly
+ * one malloc() and one free().  Requests that do not fit in the
+ * current block chain a new one rather than fail.
+ **********************************************************************/
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+#define ALIGN alignof(max_align_t)
+
+typedef struct Block {
+    struct Block* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+} Block;
+
+struct Arena {
+    Block* head;         /* first block (the one holding this header) */
+    Block* cur;          /* block allocations are served from */
+};
+
+
+static Block* block_new (size_t size)
+{
+    Block* B = malloc (sizeof(*B) + size);
+
+    if (!B)
+        return NULL;
+
+    B->next = NULL;
+    B->size = size;
+    B->used = 0;
+
+    return B;
+}
+
+
+static void* block_alloc (Block* B, size_t n)
+{
+    size_t at = (B->used + ALIGN - 1) & ~(ALIGN - 1);
+
+    if (at + n > B->size)
+        return NULL;
+
+    B->used = at + n;
+    return B->data + at;
+}
+
+
+/* creates an arena whose first block can serve size bytes of requests */
+Arena* arena_new (size_t size)
+{
+    Block* B = block_new (size + sizeof(Arena) + ALIGN);
+    Arena* A;
+
+    if (!B)
+        return NULL;
+
+    A = block_alloc (B, sizeof(*A));
+    A->head = B;
+    A->cur = B;
+
+    return A;
+}
+
+
+void* arena_alloc (Arena* A, size_t n)
+{
+    void* p = block_alloc (A->cur, n);
+    Block* B;
+
+    if (p)
+        return p;
+
+    B = block_new (n > A->cur->size ? n : A->cur->size);
+    if (!B)
+        return NULL;
+
+    A->cur->next = B;
+    A->cur = B;
+
+    return block_alloc (B, n);
+}
+
+
+void arena_destroy (Arena* A)
+{
+    Block *B, *next;
+
+    if (!A)
+        return;
+
+    for (B=A->head; B; B=next) {
+        next = B->next;
+        free (B);
+    }
+}
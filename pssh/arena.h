@@ -0,0 +1,14 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+#include <stddef.h>
+
+/* Bump allocator: everything allocated from an arena is released
+ * together by arena_destroy() */
+typedef struct Arena Arena;
+
+Arena* arena_new (size_t size);
+void* arena_alloc (Arena* A, size_t n);
+void arena_destroy (Arena* A);
+
+#endif /* _arena_h_ */
@@ -0,0 +1,120 @@
+/* Pathname expansion micro-benchmark.
+ *
+ * Fills a scratch directory with files (half of them *.gz) and times
+ * glob(3) against pattern_glob() for a few patterns: one with a literal
+ * head and tail, one with a mid, and one matching everything.
+ *
+ *   usage: glob_bench [files [iterations]]
+ *
+ * Results are printed as a JSON object (see bench/run.sh).
+ **********************************************************************/
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pattern.h"
+
+static const char* patterns[] = {
+    "access.log.*.gz", "*err*[0-9].gz", "*", NULL
+};
+
+
+static double now_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void populate (int nfiles)
+{
+    char name[64];
+    int i, fd;
+
+    for (i=0; i<nfiles; i++) {
+        if (i % 2 == 0)
+            snprintf (name, sizeof(name), "data%d.txt", i);
+        else
+            snprintf (name, sizeof(name), i % 7 ? "access.log.%d.gz" : "error%d.gz", i);
+        if ((fd = open (name, O_WRONLY | O_CREAT, 0644)) != -1)
+            close (fd);
+    }
+}
+
+
+static void cleanup (char* dir)
+{
+    glob_t g;
+    size_t i;
+
+    if (glob ("*", 0, NULL, &g) == 0) {
+        for (i=0; i<g.gl_pathc; i++)
+            unlink (g.gl_pathv[i]);
+        globfree (&g);
+    }
+    chdir ("/");
+    rmdir (dir);
+}
+
+
+int main (int argc, char** argv)
+{
+    char dir[] = "/tmp/glob_bench.XXXXXX";
+    int i, j, nfiles = 200000, iters = 5;
+    double t0, libc, ours;
+    size_t n_libc = 0, n_ours = 0;
+    PathList L = { NULL, 0, 0, NULL };
+    Pattern* G;
+    glob_t g;
+
+    if (argc > 1)
+        nfiles = atoi (argv[1]);
+    if (argc > 2)
+        iters = atoi (argv[2]);
+
+    if (!mkdtemp (dir) || chdir (dir) == -1) {
+        perror ("glob_bench");
+        return EXIT_FAILURE;
+    }
+    populate (nfiles);
+
+    printf ("{\"files\": %d", nfiles);
+    for (j=0; patterns[j]; j++) {
+        t0 = now_ns ();
+        for (i=0; i<iters; i++) {
+            if (glob (patterns[j], 0, NULL, &g) == 0) {
+                n_libc = g.gl_pathc;
+                globfree (&g);
+            }
+        }
+        libc = (now_ns () - t0) / iters / 1e6;
+
+        t0 = now_ns ();
+        for (i=0; i<iters; i++) {
+            L.A = arena_new (1 << 16);
+            L.n = 0;
+            G = pattern_compile (patterns[j], L.A);
+            n_ours = pattern_glob (G, &L);
+            arena_destroy (L.A);
+        }
+        ours = (now_ns () - t0) / iters / 1e6;
+
+        printf (", \"%s\": {\"matches\": %zu, \"libc_ms\": %.2f, \"pssh_ms\": %.2f}",
+                patterns[j], n_ours, libc, ours);
+        if (n_ours != n_libc)
+            fprintf (stderr, "glob_bench: %s: %zu matches, glob(3) found %zu\n",
+                     patterns[j], n_ours, n_libc);
+    }
+    printf ("}\n");
+
+    free (L.v);
+    cleanup (dir);
+
+    return EXIT_SUCCESS;
+}
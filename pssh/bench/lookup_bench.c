@@ -0,0 +1,78 @@
+/* Command lookup micro-benchmark.
+ *
+ * Times hash_lookup() for commands already in the table (a hit costs
+ * at most one stat() of their directory per epoch) and for the full
+ * $PATH walk taken on a miss.
+ *
+ *   usage: lookup_bench [iterations]
+ *
+ * Results are printed as a JSON object (see bench/run.sh).
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../hash.h"
+
+static const char* commands[] = {
+    "ls", "cat", "grep", "sort", "wc", "sed", "awk", "head", NULL
+};
+
+
+static double now_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int main (int argc, char** argv)
+{
+    int i, j, n = 0, iters = 20000;
+    double t0, hit_epoch, hit, miss;
+
+    if (argc > 1)
+        iters = atoi (argv[1]);
+
+    for (j=0; commands[j]; j++)
+        if (hash_lookup (commands[j]))
+            n++;
+
+    if (!n || iters <= 0) {
+        fprintf (stderr, "lookup_bench: no commands found on $PATH\n");
+        return EXIT_FAILURE;
+    }
+
+    /* new epoch every lookup: each hit revalidates its directory */
+    t0 = now_ns ();
+    for (i=0; i<iters; i++) {
+        for (j=0; commands[j]; j++) {
+            hash_new_epoch ();
+            hash_lookup (commands[j]);
+        }
+    }
+    hit_epoch = (now_ns () - t0) / ((double) iters * j);
+
+    /* same epoch: what the second lookup within one command line costs */
+    t0 = now_ns ();
+    for (i=0; i<iters; i++)
+        for (j=0; commands[j]; j++)
+            hash_lookup (commands[j]);
+    hit = (now_ns () - t0) / ((double) iters * j);
+
+    t0 = now_ns ();
+    for (i=0; i<iters/10 + 1; i++) {
+        for (j=0; commands[j]; j++) {
+            hash_reset ();
+            hash_lookup (commands[j]);
+        }
+    }
+    miss = (now_ns () - t0) / ((double) (iters/10 + 1) * j);
+
+    printf ("{\"commands\": %d, \"hit_ns\": %.1f, \"hit_new_line_ns\": %.1f, "
+            "\"miss_ns\": %.1f}\n", n, hit, hit_epoch, miss);
+
+    return EXIT_SUCCESS;
+}
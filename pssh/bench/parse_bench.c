@@ -0,0 +1,114 @@
+/* Parser micro-benchmark.
+ *
+ * Parses a corpus of command lines over and over and reports the time
+ * and the number of heap allocations parse_cmdline() makes per line.
+ * Allocations are counted by linking with --wrap for the allocator
+ * entry points (see the Makefile), so only calls made by the parser
+ * itself are seen.
+ *
+ *   usage: parse_bench [corpus-file [iterations]]
+ *
+ * Without a corpus file a built-in set of long pipelines is used.
+ * Results are printed as a JSON object (see bench/run.sh).
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../parse.h"
+
+static unsigned long nallocs;
+
+void* __real_malloc (size_t n);
+void* __real_calloc (size_t n, size_t m);
+void* __real_realloc (void* p, size_t n);
+char* __real_strdup (const char* s);
+char* __real_strndup (const char* s, size_t n);
+
+void* __wrap_malloc (size_t n)              { nallocs++; return __real_malloc (n); }
+void* __wrap_calloc (size_t n, size_t m)    { nallocs++; return __real_calloc (n, m); }
+void* __wrap_realloc (void* p, size_t n)    { nallocs++; return __real_realloc (p, n); }
+char* __wrap_strdup (const char* s)         { nallocs++; return __real_strdup (s); }
+char* __wrap_strndup (const char* s, size_t n) { nallocs++; return __real_strndup (s, n); }
+
+static const char* builtin_corpus[] = {
+    "cat access.log | grep -v \"GET /health\" | awk '{print $1}' | sort | uniq -c | sort -rn | head -20 > top.txt",
+    "find . -name '*.c' | xargs grep -l \"TODO\" | sed 's|^./||' | sort | tee todo.txt | wc -l",
+    "zcat logs/app.log.gz | grep ERROR | cut -d ' ' -f 4- | sort | uniq -c | sort -rn | head -n 50 > errors.txt &",
+    "wc -l < somefile.txt > numlines.txt",
+    "ps aux | grep -v grep | grep \"pssh worker\" | awk '{print $2}' | xargs echo | tr ' ' '\\n' | sort -n",
+    "ls -lh | grep 8.*K | wc -l",
+    "journalctl -u nginx --since today | grep -E 'upstream|timeout' | cut -c 1-120 | sort | uniq | head -100",
+    "tar -cf - src | gzip -9 | split -b 100M - backup.tar.gz. &",
+    NULL
+};
+
+
+static double now_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int main (int argc, char** argv)
+{
+    char** corpus;
+    char* line = NULL;
+    size_t cap = 0;
+    int n = 0, i, j, iters = 20000;
+    unsigned long total = 0;
+    unsigned long allocs;
+    double t0, t1;
+    char buf[8192];
+    Parse* P;
+    FILE* f;
+
+    corpus = calloc (1024, sizeof(*corpus));
+
+    if (argc > 1) {
+        if (!(f = fopen (argv[1], "r"))) {
+            perror (argv[1]);
+            return EXIT_FAILURE;
+        }
+        while (n < 1024 && getline (&line, &cap, f) > 0) {
+            line[strcspn (line, "\n")] = '\0';
+            if (*line && strlen (line) < sizeof(buf))
+                corpus[n++] = strdup (line);
+        }
+        fclose (f);
+        free (line);
+    } else {
+        for (n=0; builtin_corpus[n]; n++)
+            corpus[n] = (char*) builtin_corpus[n];
+    }
+
+    if (argc > 2)
+        iters = atoi (argv[2]);
+
+    if (!n || iters <= 0) {
+        fprintf (stderr, "parse_bench: nothing to parse\n");
+        return EXIT_FAILURE;
+    }
+
+    allocs = nallocs;
+    t0 = now_ns ();
+    for (i=0; i<iters; i++) {
+        for (j=0; j<n; j++) {
+            strcpy (buf, corpus[j]);
+            P = parse_cmdline (buf);
+            parse_destroy (&P);
+            total++;
+        }
+    }
+    t1 = now_ns ();
+    allocs = nallocs - allocs;
+
+    printf ("{\"lines\": %lu, \"ns_per_line\": %.1f, \"allocs_per_line\": %.2f}\n",
+            total, (t1 - t0) / total, (double) allocs / total);
+
+    return EXIT_SUCCESS;
+}
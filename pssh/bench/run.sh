@@ -0,0 +1,51 @@
+#!/bin/sh
+# Runs the benchmark suite and writes the results as one JSON document.
+#
+#   usage: bench/run.sh [output.json]      (default: bench/results.json)
+#
+# Expects ./pssh and the bench/ helpers to be built (make bench does
+# both).  Tunables, from the environment:
+#   BENCH_RUNS    runs per latency measurement        (default 20)
+#   BENCH_BYTES   bytes pushed through the pipeline   (default 256 MiB)
+#   BENCH_JOBS    background jobs for the reap test   (default 200)
+#   BENCH_SHELLS  shells to compare pssh against      (default: bash dash)
+
+cd "$(dirname "$0")/.." || exit 1
+
+out=${1:-bench/results.json}
+runs=${BENCH_RUNS:-20}
+bytes=${BENCH_BYTES:-268435456}
+jobs=${BENCH_JOBS:-200}
+
+shells="$PWD/pssh"
+for s in ${BENCH_SHELLS:-bash dash}; do
+    p=$(command -v "$s") && shells="$shells $p"
+done
+
+# quotes and backslashes escaped for a JSON string
+json() {
+    printf '%s' "$1" | sed 's/[\\"]/\\&/g'
+}
+
+{
+    printf '{\n'
+    printf '"host": "%s",\n' "$(json "$(uname -n)")"
+    printf '"kernel": "%s",\n' "$(json "$(uname -r)")"
+    printf '"cpus": %s,\n' "$(getconf _NPROCESSORS_ONLN)"
+    printf '"date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    printf '"commit": "%s",\n' "$(git rev-parse --short HEAD 2>/dev/null)"
+    printf '"parse": '
+    ./bench/parse_bench bench/corpus.txt
+    printf ',\n"lookup": '
+    ./bench/lookup_bench
+    printf ',\n"glob": '
+    ./bench/glob_bench
+    printf ',\n"spawn": '
+    ./bench/spawn_bench
+    printf ',\n"shells": '
+    # shellcheck disable=SC2086
+    ./bench/shell_bench -n "$runs" -s "$bytes" -j "$jobs" $shells
+    printf '}\n'
+} > "$out" || exit 1
+
+echo "bench: results written to $out"
@@ -0,0 +1,285 @@
+/* Shell overhead benchmark.
+ *
+ * Runs each shell given on the command line as `shell -c script` and
+ * measures, from the outside:
+ *
+ *   startup_us       spawn to exit of an empty script
+ *   first_byte_us    spawn to the first byte out of an N-stage pipeline
+ *                    (/bin/echo x | cat | ... | cat), for several N
+ *   pipeline_mb_s    throughput of yes | head -c SIZE | wc -c, with the
+ *                    context switches of the whole run
+ *   pipe_sizes       (pssh only) the same pipeline under `pipes -s N`
+ *                    for several pipe capacities, and in packet mode
+ *   reap             N background /bin/true jobs followed by wait
+ *
+ * A shell argument may carry options, e.g. "./pssh --spawn=vfork".
+ *
+ *   usage: shell_bench [-n runs] [-s pipeline-bytes] [-j jobs] shell...
+ *
+ * Results are printed as a JSON array with one object per shell.
+ **********************************************************************/
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 16
+
+extern char** environ;
+
+static const int stages[] = { 1, 2, 4, 8, 0 };
+static const char* pipe_sizes[] = { "64K", "256K", "1M", NULL };
+
+
+static double now_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static int cmp_double (const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* s as a JSON string */
+static void print_json_string (const char* s)
+{
+    putchar ('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf ("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf ("\\u%04x", *s);
+        else
+            putchar (*s);
+    }
+    putchar ('"');
+}
+
+
+/* splits "shell opts..." into argv and appends -c script */
+static void build_argv (char** argv, char* shell, const char* script)
+{
+    char *tok, *state;
+    int n = 0;
+
+    for (tok=strtok_r (shell, " ", &state); tok && n < MAX_ARGS-3;
+         tok=strtok_r (NULL, " ", &state))
+        argv[n++] = tok;
+
+    argv[n++] = "-c";
+    argv[n++] = (char*) script;
+    argv[n] = NULL;
+}
+
+
+static long switches ()
+{
+    struct rusage ru;
+
+    /* covers the shell and every process it reaped */
+    getrusage (RUSAGE_CHILDREN, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+
+/* runs shell -c script with stdout on a pipe; returns ns from spawn to
+ * exit, through first_byte (if not NULL) ns to the first byte, and
+ * through csw (if not NULL) the context switches of the run */
+static double run (const char* shell, const char* script, double* first_byte,
+                   long* csw)
+{
+    posix_spawn_file_actions_t fa;
+    char* argv[MAX_ARGS];
+    char* copy = strdup (shell);
+    char buf[65536];
+    int fd[2], status, first = 1;
+    double t0, t1;
+    pid_t pid;
+    ssize_t n;
+
+    build_argv (argv, copy, script);
+    if (csw)
+        *csw = switches ();
+
+    if (pipe2 (fd, O_CLOEXEC) == -1) {
+        perror ("pipe");
+        exit (EXIT_FAILURE);
+    }
+
+    posix_spawn_file_actions_init (&fa);
+    posix_spawn_file_actions_adddup2 (&fa, fd[1], STDOUT_FILENO);
+
+    t0 = now_ns ();
+    if (posix_spawn (&pid, argv[0], &fa, NULL, argv, environ)) {
+        fprintf (stderr, "shell_bench: cannot run %s\n", argv[0]);
+        exit (EXIT_FAILURE);
+    }
+    close (fd[1]);
+
+    while ((n = read (fd[0], buf, sizeof(buf))) > 0) {
+        if (first && first_byte)
+            *first_byte = now_ns () - t0;
+        first = 0;
+    }
+
+    waitpid (pid, &status, 0);
+    t1 = now_ns ();
+    if (csw)
+        *csw = switches () - *csw;
+
+    close (fd[0]);
+    posix_spawn_file_actions_destroy (&fa);
+    free (copy);
+
+    return t1 - t0;
+}
+
+
+static void print_stat (const char* name, double* v, int n, double scale)
+{
+    qsort (v, n, sizeof(*v), cmp_double);
+    printf ("\"%s\": {\"min\": %.1f, \"median\": %.1f}",
+            name, v[0] / scale, v[n/2] / scale);
+}
+
+
+/* median of three runs of a bytes-long pipeline: MB/s and the
+ * context switches of that run */
+static void pipeline (const char* shell, const char* script, long bytes,
+                      double* mb_s, long* csw)
+{
+    double v[3], t;
+    long c[3];
+    int i, j;
+
+    for (i=0; i<3; i++) {
+        t = run (shell, script, NULL, &c[i]);
+        v[i] = (bytes / 1e6) / (t / 1e9);
+    }
+
+    /* the run whose throughput is the median */
+    for (i=0; i<3; i++) {
+        int below = 0;
+        for (j=0; j<3; j++)
+            below += j != i && (v[j] < v[i] || (v[j] == v[i] && j < i));
+        if (below == 1)
+            break;
+    }
+    *mb_s = v[i];
+    *csw = c[i];
+}
+
+
+static void bench_shell (const char* shell, int runs, long bytes, int jobs)
+{
+    double v[runs], fb, mb_s;
+    long csw;
+    char script[256], *reap;
+    int i, j, k;
+    size_t len;
+
+    printf ("  {\"shell\": ");
+    print_json_string (shell);
+    printf (",\n   ");
+
+    for (i=0; i<runs; i++)
+        v[i] = run (shell, "", NULL, NULL);
+    print_stat ("startup_us", v, runs, 1e3);
+
+    printf (",\n   \"first_byte_us\": {");
+    for (k=0; stages[k]; k++) {
+        strcpy (script, "/bin/echo x");
+        for (j=1; j<stages[k]; j++)
+            strcat (script, " | cat");
+        for (i=0; i<runs; i++) {
+            run (shell, script, &fb, NULL);
+            v[i] = fb;
+        }
+        qsort (v, runs, sizeof(*v), cmp_double);
+        printf ("%s\"%d\": %.1f", k ? ", " : "", stages[k], v[runs/2] / 1e3);
+    }
+    printf ("},\n   ");
+
+    snprintf (script, sizeof(script), "yes | head -c %ld | wc -c", bytes);
+    pipeline (shell, script, bytes, &mb_s, &csw);
+    printf ("\"pipeline_mb_s\": %.1f, \"pipeline_ctx_switches\": %ld,\n   ",
+            mb_s, csw);
+
+    if (strstr (shell, "pssh")) {
+        printf ("\"pipe_sizes\": [");
+        for (k=0; pipe_sizes[k]; k++) {
+            snprintf (script, sizeof(script), "pipes -s %s yes | head -c %ld | wc -c",
+                      pipe_sizes[k], bytes);
+            pipeline (shell, script, bytes, &mb_s, &csw);
+            printf ("%s{\"size\": \"%s\", \"mb_s\": %.1f, \"ctx_switches\": %ld}",
+                    k ? ", " : "", pipe_sizes[k], mb_s, csw);
+        }
+        snprintf (script, sizeof(script), "pipes -d yes | head -c %ld | wc -c", bytes);
+        pipeline (shell, script, bytes, &mb_s, &csw);
+        printf (", {\"size\": \"packet\", \"mb_s\": %.1f, \"ctx_switches\": %ld}],\n   ",
+                mb_s, csw);
+    }
+
+    len = (size_t) jobs * 14 + 8;
+    reap = malloc (len);
+    reap[0] = '\0';
+    for (j=0; j<jobs; j++)
+        strcat (reap, "/bin/true &\n");
+    strcat (reap, "wait\n");
+    for (i=0; i<3; i++)
+        v[i] = run (shell, reap, NULL, NULL);
+    qsort (v, 3, sizeof(*v), cmp_double);
+    printf ("\"reap\": {\"jobs\": %d, \"total_ms\": %.1f, \"per_job_us\": %.1f}}",
+            jobs, v[1] / 1e6, v[1] / 1e3 / jobs);
+    free (reap);
+}
+
+
+static void usage ()
+{
+    fprintf (stderr, "usage: shell_bench [-n runs] [-s pipeline-bytes] "
+                     "[-j jobs] shell...\n");
+    exit (EXIT_FAILURE);
+}
+
+
+int main (int argc, char** argv)
+{
+    int opt, runs = 20, jobs = 200;
+    long bytes = 256L << 20;
+    int i;
+
+    while ((opt = getopt (argc, argv, "n:s:j:")) != -1) {
+        switch (opt) {
+        case 'n': runs = atoi (optarg); break;
+        case 's': bytes = atol (optarg); break;
+        case 'j': jobs = atoi (optarg); break;
+        default: usage ();
+        }
+    }
+
+    if (optind == argc || runs < 3 || bytes <= 0 || jobs <= 0)
+        usage ();
+
+    printf ("[\n");
+    for (i=optind; i<argc; i++) {
+        bench_shell (argv[i], runs, bytes, jobs);
+        printf (i + 1 < argc ? ",\n" : "\n");
+    }
+    printf ("]\n");
+
+    return EXIT_SUCCESS;
+}
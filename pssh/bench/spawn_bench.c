@@ -0,0 +1,113 @@
+/* Process launch micro-benchmark.
+ *
+ * Times spawn() followed by waitpid() of /bin/true for each backend
+ * while the process grows: after each round it touches more memory,
+ * the way an interactive shell accumulates history, completions and
+ * job tables.  fork copies the page tables of all of it; the spawn
+ * helper was forked before any of it existed.
+ *
+ *   usage: spawn_bench [iterations [MiB...]]
+ *
+ * Results are printed as a JSON object (see bench/run.sh).
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../spawn.h"
+
+static const char* backends[] = {
+    "fork", "vfork", "posix_spawn", "helper", NULL
+};
+
+static int default_sizes[] = { 0, 256, 1024 };
+
+
+static double now_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* mean microseconds to launch and reap one /bin/true */
+static double time_spawn (int iters)
+{
+    char* argv[] = { "true", NULL };
+    SpawnReq R;
+    double t0;
+    pid_t pid;
+    int i, status;
+
+    memset (&R, 0, sizeof(R));
+    R.path = "/bin/true";
+    R.argv = argv;
+    R.in_fd = STDIN_FILENO;
+    R.out_fd = STDOUT_FILENO;
+    R.err_fd = STDERR_FILENO;
+    R.pgid = -1;
+    R.tty_fd = -1;
+    R.cgroup_fd = -1;
+    R.pin_cpu = -1;
+
+    t0 = now_ns ();
+    for (i=0; i<iters; i++) {
+        if ((pid = spawn (&R)) == -1) {
+            perror ("spawn_bench");
+            exit (EXIT_FAILURE);
+        }
+        waitpid (pid, &status, 0);
+    }
+
+    return (now_ns () - t0) / iters / 1e3;
+}
+
+
+int main (int argc, char** argv)
+{
+    int* sizes = default_sizes;
+    int nsizes = sizeof(default_sizes) / sizeof(*default_sizes);
+    int i, j, iters = 200;
+    size_t have = 0, want;
+    char* ballast;
+
+    if (argc > 1)
+        iters = atoi (argv[1]);
+    if (argc > 2) {
+        nsizes = argc - 2;
+        sizes = malloc (nsizes * sizeof(*sizes));
+        for (i=0; i<nsizes; i++)
+            sizes[i] = atoi (argv[i+2]);
+    }
+
+    /* while there is next to nothing to copy */
+    if (spawn_helper_start () == -1) {
+        perror ("spawn_bench: helper");
+        return EXIT_FAILURE;
+    }
+
+    printf ("{\"iterations\": %d, \"runs\": [", iters);
+    for (i=0; i<nsizes; i++) {
+        want = (size_t)sizes[i] << 20;
+        if (want > have) {
+            ballast = malloc (want - have);
+            memset (ballast, 1, want - have);
+            have = want;
+        }
+
+        printf ("%s\n  {\"rss_mb\": %d", i ? "," : "", sizes[i]);
+        for (j=0; backends[j]; j++) {
+            spawn_set_backend (backends[j]);
+            printf (", \"%s_us\": %.1f", backends[j], time_spawn (iters));
+        }
+        printf ("}");
+    }
+    printf ("]}\n");
+
+    return EXIT_SUCCESS;
+}
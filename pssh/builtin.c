@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -7,25 +9,34 @@
 #include <stdbool.h>
 
 #include "builtin.h"
+#include "cgroup.h"
+#include "event.h"
+#include "hash.h"
+#include "history.h"
+#include "jobs.h"
+#include "mover.h"
+#include "parallel.h"
 #include "parse.h"
+#include "pin.h"
+#include "pipes.h"
+#include "plan.h"
+#include "prompt.h"
+#include "trace.h"
+
+int last_status = 0;    /* exit status of the last command, as in $? */
+int opt_errexit = 0;    /* set -e: exit when a command fails */
+
+/* pushd/popd: dirstack[ndirs-1] is the top, under the working directory */
+static char **dirstack;
+static int ndirs;
 
 const char *status_strings[] = {
     "stopped",
-    "stopped",
+    "done",
     "running",
     "running",
 };
 
-static char* builtin[] = {
-    "exit",   /* exits the shell */
-    "which",  /* displays full path to command */
-    "jobs",
-    "fg",
-    "bg",
-    "kill",
-    NULL
-};
-
 const char *sigabbrev(unsigned int sig){
 
     const char *sigs[31] = { "HUP", "INT", "QUIT", "ILL", "TRAP", "ABRT",
@@ -38,162 +49,571 @@ const char *sigabbrev(unsigned int sig){
     return sigs[sig-1];
 }
 
-int is_builtin (char* cmd)
-{
-    int i;
+static int usage(const Builtin *B, int status){
+    fprintf(stderr, "Usage: %s\n", B->usage);
+    return status;
+}
 
-    for (i=0; builtin[i]; i++) {
-        if (!strcmp (cmd, builtin[i]))
-            return 1;
+static int builtin_exit(const Builtin *B, Task T, FILE *out){
+    job_destroy_all();
+    exit(T.argv[1] ? atoi(T.argv[1]) : last_status);
+}
+
+static int builtin_which(const Builtin *B, Task T, FILE *out){
+    const char* path;
+    if(T.argv[1] == NULL){
+        return 1;
+    }
+    else if(is_builtin(T.argv[1])){
+        fprintf(stderr, "%s: shell built-in command\n",T.argv[1]);
+        return 1;
     }
 
+    path = hash_lookup (T.argv[1]);
+    if (!path)
+        return 1;
+    fprintf(out, "%s\n",path);
     return 0;
 }
 
-
-void builtin_execute (Task T, Job *arr[])
-{
-    if (!strcmp (T.cmd, "exit")) {
-        exit (EXIT_SUCCESS);
-    }
-    else if (!strcmp (T.cmd, "which")){
-        char* dir;
-        char* tmp;
-        char* path;
-        char* state;
-        char probe[PATH_MAX];
-        path = strdup(getenv("PATH"));
-        if(T.argv[1] == NULL){
-            return;
-        }
-        else if(is_builtin(T.argv[1])){
-            printf("%s: shell built-in command\n",T.argv[1]);
-            return;
-        }
-
-        for (tmp=path; ; tmp=NULL) {
-            dir = strtok_r (tmp, ":", &state);
-            if (!dir)
-                break;
-            strncpy (probe, dir, PATH_MAX-1);
-            strncat (probe, "/", PATH_MAX-1);
-            strncat (probe, T.argv[1], PATH_MAX-1);
-
-            if (access (probe, X_OK) == 0) {
-                printf("%s\n",probe);
-                break;
-            }
-        }
-        free(path);
+static int builtin_hash(const Builtin *B, Task T, FILE *out){
+    int status = 0;
+    if (T.argv[1] == NULL)
+        hash_list (out, 0);
+    else if (!strcmp (T.argv[1], "-r")) {
+        hash_reset ();
+        plan_invalidate ();
     }
-    else if(!strcmp (T.cmd, "jobs")){
-        for(int j = 0; j < 100; j++){
-            if(arr[j]){
-                printf("[%d] + %s   %s\n",j,status_strings[arr[j]->status],arr[j]->name);
-            }
+    else if (!strcmp (T.argv[1], "-l"))
+        hash_list (out, 1);
+    else if (!strcmp (T.argv[1], "-c"))
+        plan_list (out);
+    else if (!strcmp (T.argv[1], "-p")) {
+        if (!T.argv[2] || !T.argv[3])
+            return usage(B, 1);
+        plan_invalidate ();
+        if (hash_insert (T.argv[3], T.argv[2])) {
+            fprintf(stderr, "pssh: hash: %s: cannot use as a path\n", T.argv[2]);
+            status = 1;
         }
     }
-    else if(!strcmp (T.cmd, "fg")){
-        int numArgs = 0;    
-        while(T.argv[numArgs]) numArgs++;
-        if(numArgs != 2){
-            printf("Usage: fg %%<job number>\n");
-            return;
-        }
-        void (*sav)(int sig);
-        sav = signal(SIGTTOU, SIG_IGN);
-        tcsetpgrp(STDOUT_FILENO, getpgrp());
-        signal(SIGTTOU, sav);
-        char c;
-        c = T.argv[1][1];
-        c -= 48;
-        if(arr[c] == NULL){
-            printf("pssh: invalid job number: [%d]\n",c);
-            return;
-        }
-        tcsetpgrp(STDOUT_FILENO, arr[c]->pgid);
-        arr[c]->isFG = true;
-        if(arr[c]->status == STOPPED) {
-            for(int h = 0; h < arr[c]->npids; h++){
-                kill(arr[c]->pids[h], SIGCONT);
+    else {
+        for (int i = 1; T.argv[i]; i++)
+            if (!is_builtin (T.argv[i]) && !hash_lookup (T.argv[i])) {
+                fprintf(stderr, "pssh: hash: %s: not found\n", T.argv[i]);
+                status = 1;
             }
-        }
     }
-    else if(!strcmp (T.cmd, "bg")){
-        int numArgs = 0;    
-        while(T.argv[numArgs]) numArgs++;
-        
-        if(numArgs != 2){
-            printf("Usage: bg %%<job number>\n");
-            return;
-        }
-        char c;
-        c = T.argv[1][1];
-        c -= 48;
-        if(arr[c] == NULL){
-            printf("pssh: invalid job number: [%d]\n",c);
-            return;
-        }
-        arr[c]->status = BG;
-        for(int r = 0; r < arr[c]->npids; r++){
-            kill(arr[c]->pids[r], SIGCONT);
-        }
-        kill(getpgrp(), SIGCHLD);
-    }
-    else if(!strcmp (T.cmd, "kill")){
-        int numArgs = 0;
-        int signal = 15;
-        
-        while(T.argv[numArgs]) numArgs++;
-        
-        if(numArgs == 2){
-            if(T.argv[1][0] == '%'){
-                char c;
-                c = T.argv[1][1];
-                c -= 48;
-                if(arr[c] == NULL){
-                    printf("pssh: invalid job number: [%d]\n",c);
-                    return;
-                }
-                for(int t = 0; t < arr[c]->npids; t++){
-                    kill(arr[c]->pids[t], signal);
-                }
+    return status;
+}
+
+static int builtin_jobs(const Builtin *B, Task T, FILE *out){
+    int pids = 0, verbose = 0;
+    for(int i = 1; T.argv[i]; i++){
+        if(!strcmp(T.argv[i], "-l"))
+            pids = 1;
+        else if(!strcmp(T.argv[i], "-v"))
+            verbose = 1;
+        else
+            return usage(B, 2);
+    }
+    for(Job *J = job_next(NULL); J; J = job_next(J)){
+        if(pids)
+            job_print_pids(J, out);
+        else
+            fprintf(out, "[%d] %c %s   %s\n",J->id,job_mark(J),status_strings[J->status],J->name);
+        if(verbose)
+            job_print_usage(J, out, true);
+        else if(J->cgroup)
+            cg_print(J->cgroup, out);
+    }
+    return 0;
+}
+
+static int builtin_fg(const Builtin *B, Task T, FILE *out){
+    Job *J;
+    if(T.argv[1] && T.argv[2])
+        return usage(B, 1);
+    J = job_parse_spec(T.argv[1] ? T.argv[1] : "%+");
+    if(J == NULL){
+        fprintf(stderr, "pssh: invalid job: [%s]\n",T.argv[1] ? T.argv[1] : "%+");
+        return 1;
+    }
+    job_set_current(J);
+    if(isatty(STDIN_FILENO)){
+        uint64_t t0 = trace_now();
+        tcsetpgrp(STDIN_FILENO, J->pgid);
+        trace_span("tcsetpgrp", t0, J->name);
+    }
+    J->isFG = true;
+    if(J->status == STOPPED)
+        killpg(J->pgid, SIGCONT);
+    else
+        J->status = FG;
+    return 0;
+}
+
+static int builtin_bg(const Builtin *B, Task T, FILE *out){
+    Job *J;
+    if(T.argv[1] && T.argv[2])
+        return usage(B, 1);
+    J = job_parse_spec(T.argv[1] ? T.argv[1] : "%+");
+    if(J == NULL){
+        fprintf(stderr, "pssh: invalid job: [%s]\n",T.argv[1] ? T.argv[1] : "%+");
+        return 1;
+    }
+    job_set_current(J);
+    J->status = BG;
+    J->isFG = false;
+    killpg(J->pgid, SIGCONT);
+    return 0;
+}
+
+static int builtin_kill(const Builtin *B, Task T, FILE *out){
+    int signal = SIGTERM;
+    int status = 0;
+    int i = 1;
+
+    if(T.argv[1] && !strcmp (T.argv[1], "-s")){
+        if(!T.argv[2])
+            return usage(B, 1);
+        signal = atoi(T.argv[2]);
+        i = 3;
+    }
+    if(!T.argv[i])
+        return usage(B, 1);
+
+    for(; T.argv[i]; i++){
+        if(T.argv[i][0] == '%'){
+            Job *J = job_parse_spec(T.argv[i]);
+            if(J == NULL){
+                fprintf(stderr, "pssh: invalid job: [%s]\n",T.argv[i]);
+                status = 1;
+                continue;
             }
-            else{
-                if(!(kill(T.argv[1], 0))){
-                    printf("pssh: invalid pid: [%s]\n",T.argv[1]);
-                }
-                kill(atoi(T.argv[1]), signal);
+            for(int t = 0; t < J->nprocs; t++){
+                if(J->procs[t].state != PROC_DONE)
+                    kill(J->procs[t].pid, signal);
             }
-            kill(getpgrp(), SIGCHLD);
-            return;
         }
-        if(!strcmp (T.argv[1], "-s")){
-            signal = atoi(T.argv[2]);
+        else if(kill(atoi(T.argv[i]), signal) == -1){
+            fprintf(stderr, "pssh: invalid pid: [%s]\n",T.argv[i]);
+            status = 1;
         }
+    }
+    return status;
+}
 
-        if(T.argv[3][0] == '%'){
-            char c;
-            c = T.argv[3][1];
-            c -= 48;
-            if(arr[c] == NULL){
-                printf("pssh: invalid job number: [%d]\n",c);
-                return;
-            }
-            for(int t = 0; t < arr[c]->npids; t++){
-                kill(arr[c]->pids[t], signal);
-            }
+static int builtin_wait(const Builtin *B, Task T, FILE *out){
+    int status = 0;
+    /* no arguments: every job that is still running */
+    if(!T.argv[1]){
+        Job *J;
+        do{
+            for(J = job_next(NULL); J; J = job_next(J))
+                if(J->status != STOPPED) break;
+            if(J || mover_busy(0)) event_poll(-1);
+        } while(J || mover_busy(0));
+    }
+    for(int i = 1; T.argv[i]; i++){
+        Job *J = job_parse_spec(T.argv[i]);
+        unsigned long serial;
+        int id;
+        if(J == NULL){
+            fprintf(stderr, "pssh: invalid job: [%s]\n",T.argv[i]);
+            status = 127;
+            continue;
         }
-        else{
-            if(!(kill(T.argv[1], 0))){
-                printf("pssh: invalid pid: [%s]\n",T.argv[1]);
-                return;
-            }
-            kill(atoi(T.argv[3]), signal);
+        /* the reaper destroys the job when it finishes, and its taps
+         * and instrumented pipes may still have output to relay; its
+         * number may be taken by then, its serial never is */
+        id = J->id;
+        serial = J->serial;
+        while(((J = job_get(id)) && J->serial == serial) ? J->status != STOPPED : mover_busy(serial))
+            event_poll(-1);
+    }
+    return status;
+}
+
+static int builtin_parallel(const Builtin *B, Task T, FILE *out){
+    return parallel_run(T.argv, out);
+}
+
+static int builtin_tee(const Builtin *B, Task T, FILE *out){
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int i = 1, n = 0, *files;
+    int status = 0;
+    if(T.argv[1] && !strcmp(T.argv[1], "-a")){
+        flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        i++;
+    }
+    for(n = 0; T.argv[i + n]; n++);
+    files = malloc((n + 1) * sizeof(int));
+    for(n = 0; T.argv[i]; i++){
+        files[n] = open(T.argv[i], flags, 0666);
+        if(files[n] == -1){
+            fprintf(stderr, "pssh: tee: %s: %s\n", T.argv[i], strerror(errno));
+            status = 1;
+            continue;
         }
-        kill(getpgrp(), SIGCHLD);
+        n++;
     }
-    else {
-        printf ("pssh: builtin command: %s (not implemented!)\n", T.cmd);
+    fflush(out);
+    if(mover_run(mover_new(fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0),
+                           fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0),
+                           files, n)) == -1)
+        status = 1;
+    return status;
+}
+
+static int builtin_history(const Builtin *B, Task T, FILE *out){
+    if(!T.argv[1])
+        hist_print(out, -1);
+    else if(!strcmp(T.argv[1], "-s") && T.argv[2] && !T.argv[3])
+        hist_grep(out, T.argv[2]);
+    else if(T.argv[1][0] != '-' && !T.argv[2] && atol(T.argv[1]) > 0)
+        hist_print(out, atol(T.argv[1]));
+    else
+        return usage(B, 2);
+    return 0;
+}
+
+static int builtin_set(const Builtin *B, Task T, FILE *out){
+    int size;
+    if(!T.argv[1]){
+        fprintf(out, "errexit     %s\n", opt_errexit ? "on" : "off");
+        fprintf(out, "pipesize    %d\n", pipe_defaults.size);
+        fprintf(out, "pipedirect  %s\n", pipe_defaults.direct ? "on" : "off");
+        fprintf(out, "pipestats   %s\n", pipe_defaults.stats ? "on" : "off");
+        return 0;
+    }
+    for(int i = 1; T.argv[i]; i++){
+        if(!strcmp (T.argv[i], "-e"))
+            opt_errexit = 1;
+        else if(!strcmp (T.argv[i], "+e"))
+            opt_errexit = 0;
+        else if((!strcmp (T.argv[i], "-o") || !strcmp (T.argv[i], "+o")) && T.argv[i+1]){
+            int on = T.argv[i][0] == '-';
+            char *opt = T.argv[++i];
+            /* plans hold the pipe options they were compiled with */
+            if(!strncmp(opt, "pipe", 4))
+                plan_invalidate();
+            if(!strcmp(opt, "errexit"))
+                opt_errexit = on;
+            else if(!strcmp(opt, "pipedirect"))
+                pipe_defaults.direct = on;
+            else if(!strcmp(opt, "pipestats"))
+                pipe_defaults.stats = on;
+            else if(on && !strncmp(opt, "pipesize=", 9) &&
+                    (size = pipes_size(opt + 9)) != -1)
+                pipe_defaults.size = size;
+            else if(!on && !strcmp(opt, "pipesize"))
+                pipe_defaults.size = 0;
+            else
+                return usage(B, 1);
+        }
+        else
+            return usage(B, 1);
+    }
+    return 0;
+}
+
+/* chdir()s, keeping $PWD, $OLDPWD and the prompt in step */
+static int change_dir(const char *dir){
+    char old[PATH_MAX], now[PATH_MAX];
+    if(!getcwd(old, sizeof(old)))
+        old[0] = '\0';
+    if(chdir(dir) == -1){
+        fprintf(stderr, "pssh: cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if(old[0])
+        setenv("OLDPWD", old, 1);
+    if(getcwd(now, sizeof(now)))
+        setenv("PWD", now, 1);
+    prompt_chdir();
+    plan_invalidate();
+    return 0;
+}
+
+static void print_dirs(FILE *out){
+    char cwd[PATH_MAX];
+    fprintf(out, "%s", getcwd(cwd, sizeof(cwd)) ? cwd : "?");
+    for(int i = ndirs - 1; i >= 0; i--)
+        fprintf(out, " %s", dirstack[i]);
+    fprintf(out, "\n");
+}
+
+static int builtin_cd(const Builtin *B, Task T, FILE *out){
+    char dir[PATH_MAX];
+    const char *to = T.argv[1];
+    int status;
+    if(to && T.argv[2])
+        return usage(B, 2);
+    if(!to && !(to = getenv("HOME"))){
+        fprintf(stderr, "pssh: cd: HOME not set\n");
+        return 1;
+    }
+    if(strcmp(to, "-"))
+        return change_dir(to);
+    /* cd - : back to $OLDPWD, which change_dir() overwrites */
+    if(!(to = getenv("OLDPWD"))){
+        fprintf(stderr, "pssh: cd: OLDPWD not set\n");
+        return 1;
+    }
+    snprintf(dir, sizeof(dir), "%s", to);
+    if(!(status = change_dir(dir)))
+        fprintf(out, "%s\n", getenv("PWD"));
+    return status;
+}
+
+static int builtin_pushd(const Builtin *B, Task T, FILE *out){
+    char cwd[PATH_MAX];
+    char *to;
+    if(T.argv[1] && T.argv[2])
+        return usage(B, 2);
+    if(!getcwd(cwd, sizeof(cwd))){
+        fprintf(stderr, "pssh: pushd: %s\n", strerror(errno));
+        return 1;
+    }
+    if(T.argv[1])
+        to = strdup(T.argv[1]);
+    else if(ndirs)
+        to = dirstack[--ndirs];     /* swap the top two */
+    else{
+        fprintf(stderr, "pssh: pushd: no other directory\n");
+        return 1;
     }
+    if(change_dir(to)){
+        if(!T.argv[1])
+            dirstack[ndirs++] = to;
+        else
+            free(to);
+        return 1;
+    }
+    free(to);
+    dirstack = realloc(dirstack, (ndirs + 1) * sizeof(char *));
+    dirstack[ndirs++] = strdup(cwd);
+    print_dirs(out);
+    return 0;
+}
+
+static int builtin_popd(const Builtin *B, Task T, FILE *out){
+    if(T.argv[1])
+        return usage(B, 2);
+    if(!ndirs){
+        fprintf(stderr, "pssh: popd: directory stack empty\n");
+        return 1;
+    }
+    if(change_dir(dirstack[ndirs - 1]))
+        return 1;
+    free(dirstack[--ndirs]);
+    print_dirs(out);
+    return 0;
+}
+
+/* `trace on` writes a Chrome trace of every line run from now on (see
+ * trace.c) to file, pssh-trace.json by default */
+static int builtin_trace(const Builtin *B, Task T, FILE *out){
+    const char *file;
+    if(!T.argv[1]){
+        trace_print(out);
+        return 0;
+    }
+    if(!strcmp(T.argv[1], "off") && !T.argv[2]){
+        trace_stop();
+        return 0;
+    }
+    if(strcmp(T.argv[1], "on") || (T.argv[2] && T.argv[3]))
+        return usage(B, 2);
+    file = T.argv[2] ? T.argv[2] : "pssh-trace.json";
+    if(trace_start(file) == -1){
+        fprintf(stderr, "pssh: trace: %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/* `limit` options followed by a command are taken off the line before
+ * it gets here (see execute_tasks()); on its own it says where job
+ * groups would go */
+static int builtin_limit(const Builtin *B, Task T, FILE *out){
+    Limits L;
+    int k = limit_parse(T.argv, &L);
+    if(k == -1)
+        return usage(B, 2);
+    if(T.argv[k]){
+        fprintf(stderr, "pssh: limit: must start the pipeline\n");
+        return 2;
+    }
+    if(!cg_base()){
+        fprintf(stderr, "pssh: limit: no writable cgroup v2 hierarchy\n");
+        return 1;
+    }
+    fprintf(out, "%s\n", cg_base());
+    return 0;
+}
+
+/* like `limit`: on its own it shows the order `pin -a` places stages in */
+static int builtin_pin(const Builtin *B, Task T, FILE *out){
+    Pin P;
+    int k = pin_parse(T.argv, &P);
+    if(k == -1)
+        return usage(B, 2);
+    if(T.argv[k]){
+        fprintf(stderr, "pssh: pin: must start the pipeline\n");
+        return 2;
+    }
+    pin_print_order(out);
+    return 0;
+}
+
+/* like `limit`: on its own it shows what a job's pipes would be */
+static int builtin_pipes(const Builtin *B, Task T, FILE *out){
+    PipeOpts O;
+    int k = pipes_parse(T.argv, &O);
+    if(k == -1)
+        return usage(B, 2);
+    if(T.argv[k]){
+        fprintf(stderr, "pssh: pipes: must start the pipeline\n");
+        return 2;
+    }
+    fprintf(out, "size %d (max %d)%s%s\n", O.size, pipes_max(),
+            O.direct ? ", packet mode" : "", O.stats ? ", instrumented" : "");
+    return 0;
+}
+
+/* Every builtin.  This is the only place one is registered: the lookup
+ * table below and tab completion are both derived from it. */
+static const Builtin builtins[] = {
+    { "exit",     builtin_exit,     0,
+      "exit [n]" },
+    { "which",    builtin_which,    BUILTIN_FORKABLE | BUILTIN_PURE,
+      "which <command>" },
+    { "jobs",     builtin_jobs,     BUILTIN_FORKABLE | BUILTIN_PURE,
+      "jobs [-l | -v]" },
+    { "fg",       builtin_fg,       BUILTIN_JOBCTL,
+      "fg [%<job>]" },
+    { "bg",       builtin_bg,       BUILTIN_JOBCTL,
+      "bg [%<job>]" },
+    { "kill",     builtin_kill,     BUILTIN_FORKABLE | BUILTIN_JOBCTL,
+      "kill [-s <signal>] <pid> | %<job> ..." },
+    { "hash",     builtin_hash,     BUILTIN_FORKABLE,
+      "hash [-clr] [-p path] [name ...]" },
+    { "set",      builtin_set,      BUILTIN_FORKABLE,
+      "set [-e|+e] [-o|+o errexit|pipedirect|pipestats|pipesize[=size]]" },
+    { "wait",     builtin_wait,     BUILTIN_JOBCTL,
+      "wait [%<job> ...]" },
+    { "parallel", builtin_parallel, BUILTIN_FORKABLE,
+      "parallel [-j N] command [arg...] [::: input...]" },
+    { "tee",      builtin_tee,      BUILTIN_FORKABLE,
+      "tee [-a] [file ...]" },
+    { "history",  builtin_history,  BUILTIN_FORKABLE | BUILTIN_PURE,
+      "history [n | -s text]" },
+    { "limit",    builtin_limit,    BUILTIN_FORKABLE | BUILTIN_PURE,
+      "limit [-m bytes[KMGT]] [-c cpus] [-p pids] [command ...]" },
+    { "pin",      builtin_pin,      BUILTIN_FORKABLE | BUILTIN_PURE,
+      "pin [-c cpus] [-N node] [-a] [-b|-i] [-n nice] [-o class[:level]] [command ...]" },
+    { "pipes",    builtin_pipes,    BUILTIN_FORKABLE | BUILTIN_PURE,
+      "pipes [-s size[KM]] [-d|-D] [-v] [command ...]" },
+    { "cd",       builtin_cd,       0,
+      "cd [dir | -]" },
+    { "pushd",    builtin_pushd,    0,
+      "pushd [dir]" },
+    { "popd",     builtin_popd,     0,
+      "popd" },
+    { "trace",    builtin_trace,    0,
+      "trace [on [file] | off]" },
+};
+
+#define NBUILTINS   (sizeof(builtins) / sizeof(builtins[0]))
+#define HASH_SLOTS  64      /* power of two, comfortably over NBUILTINS */
+
+/* Perfect hash over builtins[]: slot[hash(name)] is 1 + the index of
+ * the only builtin that hashes there, or 0.  The hash is 32-bit FNV-1a
+ * from SLOT_SEED, which happens to give every name a slot of its own.
+ * Adding or reordering builtins means redoing the table (and, if two
+ * names then collide, picking another seed); builtin_init() refuses to
+ * start a shell whose table does not match builtins[]. */
+#define SLOT_SEED   2166136261u
+
+static const unsigned char slot[HASH_SLOTS] = {
+    [2] = 16,     /* cd */
+    [3] = 8,      /* set */
+    [5] = 1,      /* exit */
+    [17] = 7,     /* hash */
+    [20] = 14,    /* pin */
+    [25] = 6,     /* kill */
+    [26] = 4,     /* fg */
+    [28] = 18,    /* popd */
+    [31] = 12,    /* history */
+    [32] = 9,     /* wait */
+    [34] = 2,     /* which */
+    [38] = 5,     /* bg */
+    [46] = 19,    /* trace */
+    [50] = 10,    /* parallel */
+    [52] = 13,    /* limit */
+    [53] = 11,    /* tee */
+    [59] = 17,    /* pushd */
+    [61] = 3,     /* jobs */
+    [62] = 15,    /* pipes */
+};
+
+static unsigned int builtin_hash_str(const char *s){
+    unsigned int h = SLOT_SEED;
+    while(*s){
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h & (HASH_SLOTS - 1);
+}
+
+/* checks slot[] against builtins[]: each builtin must be where its
+ * name hashes, which also rules out two sharing a slot */
+void builtin_init(void){
+    unsigned int i;
+    _Static_assert(NBUILTINS < HASH_SLOTS && NBUILTINS < 256, "grow HASH_SLOTS");
+
+    for(i = 0; i < NBUILTINS; i++){
+        if(slot[builtin_hash_str(builtins[i].name)] != i + 1){
+            fprintf(stderr, "pssh: builtin slot table is stale at %s\n",
+                    builtins[i].name);
+            abort();
+        }
+    }
+}
+
+/* the builtin named cmd, or NULL; one hash and one strcmp() */
+const Builtin *builtin_lookup(const char *cmd){
+    const Builtin *B;
+    int i;
+
+    i = slot[builtin_hash_str(cmd)];
+    if(!i)
+        return NULL;
+    B = &builtins[i - 1];
+    return strcmp(B->name, cmd) ? NULL : B;
+}
+
+/* i-th builtin's name, NULL past the last one */
+const char *builtin_name(int i){
+    return i < NBUILTINS ? builtins[i].name : NULL;
+}
+
+int is_builtin (char* cmd)
+{
+    return builtin_lookup (cmd) != NULL;
+}
+
+
+int builtin_execute (Task T, FILE* out)
+{
+    const Builtin *B = builtin_lookup (T.cmd);
+
+    if (!B) {
+        fprintf (stderr, "pssh: builtin command: %s (not implemented!)\n", T.cmd);
+        return 1;
+    }
+
+    return B->fn (B, T, out);
 }
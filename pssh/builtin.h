@@ -1,26 +1,34 @@
 #ifndef _builtin_h_
 #define _builtin_h_
 
+#include <stdio.h>
+
+#include "jobs.h"
 #include "parse.h"
 
-typedef enum {
-    STOPPED,
-    TERM,
-    BG,
-    FG,
-} JobStatus;
+/* Builtin flags */
+#define BUILTIN_FORKABLE  0x1   /* as a pipeline stage, may run in a forked
+                                   child; without this or BUILTIN_PURE it
+                                   cannot be a stage at all */
+#define BUILTIN_JOBCTL    0x2   /* may hand the terminal to a job */
+#define BUILTIN_PURE      0x4   /* only reads shell state and prints; as a
+                                   pipeline stage it runs inside the shell */
+
+typedef struct Builtin {
+    const char* name;
+    int (*fn) (const struct Builtin* B, Task T, FILE* out);
+    unsigned int flags;
+    const char* usage;
+} Builtin;
 
-typedef struct {
-    char* name;
-    pid_t* pids;
-    unsigned int npids;
-    pid_t pgid;
-    JobStatus status;
-    bool isFG;
-} Job;
+extern int last_status;
+extern int opt_errexit;
+extern int interactive;
 
+void builtin_init (void);
+const Builtin* builtin_lookup (const char* cmd);
 int is_builtin (char* cmd);
-void builtin_execute (Task T, Job *arr[]);
-int builtin_which (Task T);
+const char* builtin_name (int i);
+int builtin_execute (Task T, FILE* out);
 
 #endif /* _builtin_h_ */
@@ -0,0 +1,412 @@
+/* Per-job cgroup v2 groups.
+ *
+ *   limit [-m bytes[KMGT]] [-c cpus] [-p pids] command [| command]*
+ *
+ * runs the pipeline in a cgroup of its own, created as a child of the
+ * cgroup the shell itself was started in, which must have been
+ * delegated to the user (a systemd user scope, or a container's root):
+ *
+ *   -m   memory.max
+ *   -c   cpu.max, in CPUs (fractions allowed) per CPU_PERIOD
+ *   -p   pids.max
+ *
+ * Without options the job is only accounted.  A cgroup may hand its
+ * controllers down only while no process lives in it (the root being
+ * exempt), so the first limit that needs a controller moves the shell
+ * into a leaf of its own, pssh.<pid>, beside its job groups.
+ *
+ * Stages join the group between fork and exec by writing to an open
+ * cgroup.procs, so nothing a stage starts can run outside of it.  The
+ * group goes when its job does; the kernel refuses to remove one that
+ * still has processes, which are then left in it.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "cgroup.h"
+
+#define CPU_PERIOD 100000
+
+struct CGroup {
+    char* path;
+    int procs;           /* its cgroup.procs, O_CLOEXEC */
+    Limits limits;
+};
+
+static char* base;       /* the shell's own cgroup, NULL: none found */
+static int base_searched;
+static unsigned int nextseq;
+
+static const char* controllers[] = { "memory", "cpu", "pids" };
+
+
+/* parses a size such as 512M; returns -1 if it is not one */
+static long long parse_size (const char* s)
+{
+    char* end;
+    long long n = strtoll (s, &end, 10);
+
+    if (end == s || n <= 0)
+        return -1;
+
+    switch (*end) {
+    case 'T': case 't': n <<= 10;   /* fall through */
+    case 'G': case 'g': n <<= 10;   /* fall through */
+    case 'M': case 'm': n <<= 10;   /* fall through */
+    case 'K': case 'k': n <<= 10; end++;
+    }
+
+    return *end ? -1 : n;
+}
+
+
+/* fills L from the options of a `limit` argv; returns the index of the
+ * command word (which may be the terminating NULL) or -1 if an option
+ * is malformed */
+int limit_parse (char** argv, Limits* L)
+{
+    char* end;
+    double cpus;
+    int i;
+
+    memset (L, 0, sizeof(*L));
+
+    for (i=1; argv[i] && argv[i][0] == '-'; i++) {
+        if (!strcmp (argv[i], "--"))
+            return i + 1;
+        if (!argv[i+1] || argv[i][2])
+            return -1;
+
+        switch (argv[i][1]) {
+        case 'm':
+            if ((L->memory = parse_size (argv[++i])) == -1)
+                return -1;
+            break;
+        case 'c':
+            cpus = strtod (argv[++i], &end);
+            if (*end || cpus <= 0 || cpus * CPU_PERIOD < 1000)
+                return -1;
+            L->cpu = cpus * CPU_PERIOD;
+            break;
+        case 'p':
+            L->pids = strtol (argv[++i], &end, 10);
+            if (*end || L->pids <= 0)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return i;
+}
+
+
+static int write_file (const char* dir, const char* file, const char* s)
+{
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf (path, sizeof(path), "%s/%s", dir, file);
+    fd = open (path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    n = write (fd, s, strlen (s));
+    close (fd);
+
+    return n == -1 ? -1 : 0;
+}
+
+
+/* reads dir/file into buf; returns -1 if it cannot be read */
+static int read_file (const char* dir, const char* file, char* buf, size_t size)
+{
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf (path, sizeof(path), "%s/%s", dir, file);
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    n = read (fd, buf, size - 1);
+    close (fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+
+    return 0;
+}
+
+
+/* true if the space-separated list contains word */
+static int has_word (const char* list, const char* word)
+{
+    size_t len = strlen (word);
+    const char* s;
+
+    for (s=list; (s=strstr (s, word)); s+=len)
+        if ((s == list || s[-1] == ' ') && (!s[len] || s[len] == ' ' || s[len] == '\n'))
+            return 1;
+
+    return 0;
+}
+
+
+/* the cgroup2 mount point and the shell's path below it */
+static char* find_base ()
+{
+    char line[PATH_MAX * 2], mnt[PATH_MAX], root[PATH_MAX], *own = NULL;
+    char *sep, *res = NULL;
+    size_t rlen;
+    FILE* f;
+
+    if (!(f = fopen ("/proc/self/cgroup", "re")))
+        return NULL;
+    while (fgets (line, sizeof(line), f)) {
+        if (!strncmp (line, "0::", 3)) {
+            line[strcspn (line, "\n")] = '\0';
+            own = strdup (line + 3);
+            break;
+        }
+    }
+    fclose (f);
+    if (!own)
+        return NULL;
+
+    if (!(f = fopen ("/proc/self/mountinfo", "re"))) {
+        free (own);
+        return NULL;
+    }
+    while (!res && fgets (line, sizeof(line), f)) {
+        sep = strstr (line, " - ");
+        if (!sep || strncmp (sep, " - cgroup2 ", 11))
+            continue;
+        if (sscanf (line, "%*s %*s %*s %s %s", root, mnt) != 2)
+            continue;
+        /* a namespaced mount shows the tree from its own root down */
+        rlen = strcmp (root, "/") ? strlen (root) : 0;
+        if (strncmp (own, root, rlen))
+            continue;
+        if (asprintf (&res, "%s%s", mnt, own + rlen) == -1)
+            res = NULL;
+    }
+    fclose (f);
+    free (own);
+
+    /* a trailing slash when the shell sits in the root */
+    if (res && strlen (res) > 1 && res[strlen (res) - 1] == '/')
+        res[strlen (res) - 1] = '\0';
+
+    return res;
+}
+
+
+/* the cgroup job groups are created in, or NULL if there is none the
+ * shell can write to */
+const char* cg_base ()
+{
+    if (!base_searched) {
+        base_searched = 1;
+        base = find_base ();
+        if (base && access (base, W_OK) == -1) {
+            free (base);
+            base = NULL;
+        }
+    }
+
+    return base;
+}
+
+
+static int is_root ()
+{
+    char buf[64];
+
+    /* only the root cgroup lacks a cgroup.type */
+    return read_file (base, "cgroup.type", buf, sizeof(buf)) == -1 && errno == ENOENT;
+}
+
+
+/* makes controller available to the groups below base */
+static int enable (const char* controller)
+{
+    char buf[256], leaf[PATH_MAX], ctl[64];
+
+    if (read_file (base, "cgroup.subtree_control", buf, sizeof(buf)) == 0 &&
+        has_word (buf, controller))
+        return 0;
+
+    if (read_file (base, "cgroup.controllers", buf, sizeof(buf)) == -1 ||
+        !has_word (buf, controller)) {
+        fprintf (stderr, "pssh: limit: the %s controller is not delegated to %s\n",
+                 controller, base);
+        return -1;
+    }
+
+    if (!is_root ()) {
+        /* no internal processes: the shell steps out of the way first */
+        snprintf (leaf, sizeof(leaf), "%s/pssh.%d", base, getpid ());
+        if ((mkdir (leaf, 0755) == -1 && errno != EEXIST) ||
+            write_file (leaf, "cgroup.procs", "0") == -1) {
+            fprintf (stderr, "pssh: limit: %s: %s\n", leaf, strerror (errno));
+            return -1;
+        }
+    }
+
+    snprintf (ctl, sizeof(ctl), "+%s", controller);
+    if (write_file (base, "cgroup.subtree_control", ctl) == -1) {
+        fprintf (stderr, "pssh: limit: enabling %s in %s: %s\n",
+                 controller, base, strerror (errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* creates a group with limits L; returns NULL, having said why, if it
+ * cannot be set up */
+CGroup* cg_new (const Limits* L)
+{
+    long long want[] = { L->memory, L->cpu, L->pids };
+    char buf[64], procs[PATH_MAX];
+    CGroup* G;
+    int i;
+
+    if (!cg_base ()) {
+        fprintf (stderr, "pssh: limit: no writable cgroup v2 hierarchy\n");
+        return NULL;
+    }
+
+    for (i=0; i<3; i++)
+        if (want[i] && enable (controllers[i]) == -1)
+            return NULL;
+
+    G = calloc (1, sizeof(*G));
+    G->limits = *L;
+    G->procs = -1;
+    if (asprintf (&G->path, "%s/pssh.%d.%u", base, getpid (), ++nextseq) == -1) {
+        free (G);
+        return NULL;
+    }
+    if (mkdir (G->path, 0755) == -1) {
+        fprintf (stderr, "pssh: limit: %s: %s\n", G->path, strerror (errno));
+        free (G->path);
+        free (G);
+        return NULL;
+    }
+
+    if (L->memory) {
+        snprintf (buf, sizeof(buf), "%lld", L->memory);
+        if (write_file (G->path, "memory.max", buf) == -1)
+            goto fail;
+    }
+    if (L->cpu) {
+        snprintf (buf, sizeof(buf), "%ld %d", L->cpu, CPU_PERIOD);
+        if (write_file (G->path, "cpu.max", buf) == -1)
+            goto fail;
+    }
+    if (L->pids) {
+        snprintf (buf, sizeof(buf), "%ld", L->pids);
+        if (write_file (G->path, "pids.max", buf) == -1)
+            goto fail;
+    }
+
+    snprintf (procs, sizeof(procs), "%s/cgroup.procs", G->path);
+    G->procs = open (procs, O_WRONLY | O_CLOEXEC);
+    if (G->procs == -1)
+        goto fail;
+
+    return G;
+
+fail:
+    fprintf (stderr, "pssh: limit: %s: %s\n", G->path, strerror (errno));
+    cg_destroy (G);
+    return NULL;
+}
+
+
+/* a stage writes "0" here to join the group */
+int cg_procs_fd (const CGroup* G)
+{
+    return G->procs;
+}
+
+
+static void print_bytes (FILE* out, long long n)
+{
+    const char* unit = "KMGT";
+    double v = n;
+    int u = -1;
+
+    while (v >= 1024 && u < 3) {
+        v /= 1024;
+        u++;
+    }
+
+    if (u < 0)
+        fprintf (out, "%lldB", n);
+    else
+        fprintf (out, "%.1f%c", v, unit[u]);
+}
+
+
+/* one line of live usage: memory, CPU time and processes */
+void cg_print (const CGroup* G, FILE* out)
+{
+    char buf[1024], *s;
+    long long usec = -1;
+
+    fprintf (out, "    cgroup %s:", strrchr (G->path, '/') + 1);
+
+    if (read_file (G->path, "memory.current", buf, sizeof(buf)) == 0) {
+        fprintf (out, " mem ");
+        print_bytes (out, atoll (buf));
+        if (G->limits.memory) {
+            fprintf (out, "/");
+            print_bytes (out, G->limits.memory);
+        }
+    }
+
+    if (read_file (G->path, "cpu.stat", buf, sizeof(buf)) == 0 &&
+        (s = strstr (buf, "usage_usec ")))
+        usec = atoll (s + 11);
+    if (usec >= 0) {
+        fprintf (out, " cpu %.3fs", usec / 1e6);
+        if (G->limits.cpu)
+            fprintf (out, " (max %.2f CPUs)", (double) G->limits.cpu / CPU_PERIOD);
+    }
+
+    if (read_file (G->path, "pids.current", buf, sizeof(buf)) == 0) {
+        fprintf (out, " pids %lld", atoll (buf));
+        if (G->limits.pids)
+            fprintf (out, "/%ld", G->limits.pids);
+    }
+
+    fprintf (out, "\n");
+}
+
+
+/* closes and removes the group; anything still in it keeps it alive */
+void cg_destroy (CGroup* G)
+{
+    if (!G)
+        return;
+
+    if (G->procs != -1)
+        close (G->procs);
+    rmdir (G->path);
+
+    free (G->path);
+    free (G);
+}
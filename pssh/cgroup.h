@@ -0,0 +1,27 @@
+#ifndef _cgroup_h_
+#define _cgroup_h_
+
+#include <stdio.h>
+
+/* Per-job cgroup v2 groups, for the `limit` builtin.
+ *
+ * A limited job gets a cgroup of its own under the one the shell was
+ * started in, with any of memory.max, cpu.max and pids.max set, and
+ * every stage joins it between fork and exec through cg_procs_fd(). */
+
+typedef struct {
+    long long memory;    /* memory.max, in bytes; 0: no limit */
+    long cpu;            /* cpu.max quota per CPU_PERIOD us; 0: no limit */
+    long pids;           /* pids.max; 0: no limit */
+} Limits;
+
+typedef struct CGroup CGroup;
+
+int limit_parse (char** argv, Limits* L);
+const char* cg_base (void);
+CGroup* cg_new (const Limits* L);
+int cg_procs_fd (const CGroup* G);
+void cg_print (const CGroup* G, FILE* out);
+void cg_destroy (CGroup* G);
+
+#endif /* _cgroup_h_ */
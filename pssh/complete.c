@@ -0,0 +1,359 @@
+/* Tab completion.
+ *
+ * The first word of a command (at the start of the line or after a |)
+ * completes from an index of every executable on $PATH plus the
+ * builtins.  The index is a sorted array of names, each tagged with a
+ * bitmask of the $PATH directories it appears in, so a completion is
+ * two binary searches for the range of names sharing the prefix.
+ *
+ * The index is built once and then kept current with inotify: each
+ * $PATH directory is watched, and a name created, deleted, renamed or
+ * chmod()ed there flips that directory's bit on its entry.  Entries
+ * whose mask drops to zero are removed.  A new $PATH rebuilds it.
+ *
+ * Job specs complete for fg, bg, kill and wait; anything else falls
+ * through to readline's filename completion.
+ **********************************************************************/
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "builtin.h"
+#include "complete.h"
+#include "event.h"
+#include "jobs.h"
+
+#define MAX_DIRS    63
+#define BUILTIN_BIT (1ULL << 63)
+#define WATCH_MASK  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                     IN_ATTRIB | IN_ONLYDIR)
+
+typedef struct {
+    char* name;
+    uint64_t dirs;       /* bit i: found in dirs[i]; BUILTIN_BIT: builtin */
+} Entry;
+
+static Entry* names;
+static size_t nnames;
+static size_t cap_names;
+
+static char* dirs[MAX_DIRS];
+static int wds[MAX_DIRS];
+static int ndirs;
+static char* indexed_path;      /* $PATH the index was built for */
+static int inotify_fd = -1;
+
+/* generator state between readline's calls */
+static size_t match_at, match_end;
+static Job* match_job;
+
+
+static int entry_cmp (const void* a, const void* b)
+{
+    return strcmp (((const Entry*) a)->name, ((const Entry*) b)->name);
+}
+
+
+/* first entry not less than name */
+static size_t lower_bound (const char* name, size_t len)
+{
+    size_t lo = 0, hi = nnames, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strncmp (names[mid].name, name, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* first entry past those starting with prefix */
+static size_t upper_bound (const char* prefix, size_t len)
+{
+    size_t lo = 0, hi = nnames, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strncmp (names[mid].name, prefix, len) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+static void set_bit (const char* name, uint64_t bit, int on)
+{
+    size_t len = strlen (name) + 1;
+    size_t at = lower_bound (name, len);
+    int found = at < nnames && !strcmp (names[at].name, name);
+
+    if (found) {
+        if (on)
+            names[at].dirs |= bit;
+        else
+            names[at].dirs &= ~bit;
+
+        if (!names[at].dirs) {
+            free (names[at].name);
+            memmove (&names[at], &names[at+1], (nnames - at - 1) * sizeof(*names));
+            nnames--;
+        }
+        return;
+    }
+
+    if (!on)
+        return;
+
+    if (nnames == cap_names) {
+        cap_names = cap_names ? cap_names * 2 : 1024;
+        names = realloc (names, cap_names * sizeof(*names));
+    }
+    memmove (&names[at+1], &names[at], (nnames - at) * sizeof(*names));
+    names[at].name = strdup (name);
+    names[at].dirs = bit;
+    nnames++;
+}
+
+
+static int is_executable (int dfd, const char* name)
+{
+    struct stat st;
+
+    return !fstatat (dfd, name, &st, 0) && S_ISREG (st.st_mode) &&
+           (st.st_mode & 0111);
+}
+
+
+/* re-checks one name in one directory after inotify reported it */
+static void recheck (int d, const char* name)
+{
+    int dfd = open (dirs[d], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dfd == -1)
+        return;
+
+    set_bit (name, 1ULL << d, is_executable (dfd, name));
+    close (dfd);
+}
+
+
+static void on_inotify (int fd, unsigned int events, void* arg)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event* ev;
+    ssize_t n;
+    char* p;
+    int d;
+
+    while ((n = read (fd, buf, sizeof(buf))) > 0) {
+        for (p=buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event*) p;
+            if (!ev->len)
+                continue;
+            /* a symlinked $PATH entry shares its target's wd */
+            for (d=0; d<ndirs; d++)
+                if (wds[d] == ev->wd)
+                    recheck (d, ev->name);
+        }
+    }
+}
+
+
+static void clear_index ()
+{
+    size_t i;
+    int d;
+
+    for (i=0; i<nnames; i++)
+        free (names[i].name);
+    nnames = 0;
+
+    for (d=0; d<ndirs; d++) {
+        if (wds[d] != -1)
+            inotify_rm_watch (inotify_fd, wds[d]);
+        free (dirs[d]);
+    }
+    ndirs = 0;
+}
+
+
+/* scans every $PATH directory and starts watching it */
+static void build_index (const char* path)
+{
+    char *copy, *dir, *state;
+    struct dirent* de;
+    DIR* D;
+    size_t i, j;
+    int b;
+
+    clear_index ();
+
+    copy = strdup (path);
+    for (dir=strtok_r (copy, ":", &state); dir && ndirs < MAX_DIRS;
+         dir=strtok_r (NULL, ":", &state)) {
+        D = opendir (dir);
+        if (!D)
+            continue;
+
+        dirs[ndirs] = strdup (dir);
+        wds[ndirs] = inotify_fd == -1 ? -1 :
+                     inotify_add_watch (inotify_fd, dir, WATCH_MASK);
+
+        while ((de = readdir (D))) {
+            if (de->d_name[0] == '.' || de->d_type == DT_DIR)
+                continue;
+            if (!is_executable (dirfd (D), de->d_name))
+                continue;
+            if (nnames == cap_names) {
+                cap_names = cap_names ? cap_names * 2 : 1024;
+                names = realloc (names, cap_names * sizeof(*names));
+            }
+            names[nnames].name = strdup (de->d_name);
+            names[nnames].dirs = 1ULL << ndirs;
+            nnames++;
+        }
+
+        closedir (D);
+        ndirs++;
+    }
+    free (copy);
+
+    for (b=0; builtin_name (b); b++) {
+        names = realloc (names, (nnames + 1) * sizeof(*names));
+        names[nnames].name = strdup (builtin_name (b));
+        names[nnames].dirs = BUILTIN_BIT;
+        nnames++;
+    }
+    cap_names = nnames;
+
+    /* sort, then fold names found in several places into one entry */
+    qsort (names, nnames, sizeof(*names), entry_cmp);
+    for (i=0, j=0; i<nnames; i++) {
+        if (j && !strcmp (names[j-1].name, names[i].name)) {
+            names[j-1].dirs |= names[i].dirs;
+            free (names[i].name);
+        } else
+            names[j++] = names[i];
+    }
+    nnames = j;
+
+    free (indexed_path);
+    indexed_path = strdup (path);
+}
+
+
+static char* command_generator (const char* text, int state)
+{
+    if (!state) {
+        size_t len = strlen (text);
+        match_at = lower_bound (text, len);
+        match_end = upper_bound (text, len);
+    }
+
+    if (match_at < match_end)
+        return strdup (names[match_at++].name);
+
+    return NULL;
+}
+
+
+static char* job_generator (const char* text, int state)
+{
+    char spec[16];
+
+    if (!state)
+        match_job = job_next (NULL);
+
+    for (; match_job; match_job = job_next (match_job)) {
+        snprintf (spec, sizeof(spec), "%%%d", match_job->id);
+        if (!strncmp (spec, text, strlen (text))) {
+            match_job = job_next (match_job);
+            return strdup (spec);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* the command word of the task the cursor is in, or NULL if the
+ * cursor is still in it */
+static const char* task_command (int start, size_t* len)
+{
+    int i = start, end;
+
+    while (i > 0 && rl_line_buffer[i-1] != '|')
+        i--;
+    while (i < start && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t'))
+        i++;
+    if (i == start)
+        return NULL;
+
+    for (end=i; end < start && rl_line_buffer[end] != ' ' &&
+                rl_line_buffer[end] != '\t'; end++);
+    *len = end - i;
+
+    return rl_line_buffer + i;
+}
+
+
+static char** complete (const char* text, int start, int end)
+{
+    const char* path = getenv ("PATH");
+    const char* cmd;
+    size_t len;
+
+    cmd = task_command (start, &len);
+
+    if (!cmd) {
+        /* a path is completed as a file, like any argument */
+        if (strchr (text, '/'))
+            return NULL;
+        if (!path)
+            path = "";
+        if (!indexed_path || strcmp (path, indexed_path))
+            build_index (path);
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches (text, command_generator);
+    }
+
+    if ((*text == '%' || !*text) &&
+        ((len == 2 && (!strncmp (cmd, "fg", 2) || !strncmp (cmd, "bg", 2))) ||
+         (len == 4 && (!strncmp (cmd, "kill", 4) || !strncmp (cmd, "wait", 4))))) {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches (text, job_generator);
+    }
+
+    return NULL;
+}
+
+
+/* installs the completer and builds the command names */
+void complete_init ()
+{
+    const char* path = getenv ("PATH");
+
+    inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd != -1 &&
+        event_watch (inotify_fd, EPOLLIN, on_inotify, NULL) == -1) {
+        close (inotify_fd);
+        inotify_fd = -1;
+    }
+
+    build_index (path ? path : "");
+    rl_attempted_completion_function = complete;
+}
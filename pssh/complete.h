@@ -0,0 +1,10 @@
+#ifndef _complete_h_
+#define _complete_h_
+
+/* Readline completion: commands from an inotify-maintained index of
+ * $PATH and the builtins, job specs for fg/bg/kill/wait, and filenames
+ * for everything else.  Needs the event loop to be running. */
+
+void complete_init (void);
+
+#endif /* _complete_h_ */
@@ -0,0 +1,161 @@
+/* epoll/signalfd event loop.
+ *
+ * A pending SIGCHLD stays pending on the signalfd until it is read, so
+ * a child that exits before anyone is waiting for it can no longer be
+ * missed the way it could between a check and a pause().  Any number
+ * of exits coalesce into one readable signalfd; the reaper is expected
+ * to waitpid(WNOHANG) until there is nothing left to collect.
+ **********************************************************************/
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "event.h"
+
+#define MAX_EVENTS 16
+
+typedef struct Watch {
+    int fd;
+    EventFn fn;
+    void* arg;
+    struct Watch* next;
+} Watch;
+
+static int epfd = -1;
+static int sigfd = -1;
+static void (*reap)(void);
+static Watch* watches;
+
+
+static void on_signal (int fd, unsigned int events, void* arg)
+{
+    struct signalfd_siginfo si[MAX_EVENTS];
+
+    /* drain; one pass of the reaper collects every exited child */
+    while (read (fd, si, sizeof(si)) > 0);
+
+    if (reap)
+        reap ();
+}
+
+
+static Watch* find_watch (int fd)
+{
+    Watch* W;
+
+    for (W=watches; W; W=W->next)
+        if (W->fd == fd)
+            return W;
+
+    return NULL;
+}
+
+
+/* blocks SIGCHLD and sets up the loop; reaper is called whenever
+ * SIGCHLD has been delivered since the last poll */
+int event_init (void (*reaper)(void))
+{
+    sigset_t set;
+
+    sigemptyset (&set);
+    sigaddset (&set, SIGCHLD);
+
+    if (sigprocmask (SIG_BLOCK, &set, NULL) == -1)
+        return -1;
+
+    sigfd = signalfd (-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigfd == -1)
+        return -1;
+
+    epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epfd == -1)
+        return -1;
+
+    reap = reaper;
+
+    return event_watch (sigfd, EPOLLIN, on_signal, NULL);
+}
+
+
+/* in a fork()ed child that keeps running shell code: forgets the
+ * parent's watches, whose descriptors are gone, and starts a loop of
+ * its own so the child's SIGCHLD is not the parent's */
+int event_reinit ()
+{
+    Watch* W;
+
+    while ((W = watches)) {
+        watches = W->next;
+        free (W);
+    }
+    if (epfd != -1)
+        close (epfd);
+    if (sigfd != -1)
+        close (sigfd);
+
+    return event_init (reap);
+}
+
+
+/* calls fn from event_poll() whenever fd has any of events pending.
+ * Fails with EPERM for descriptors epoll cannot watch (regular files) */
+int event_watch (int fd, unsigned int events, EventFn fn, void* arg)
+{
+    struct epoll_event ev;
+    Watch* W;
+
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+
+    W = malloc (sizeof(*W));
+    W->fd = fd;
+    W->fn = fn;
+    W->arg = arg;
+    W->next = watches;
+    watches = W;
+
+    return 0;
+}
+
+
+void event_unwatch (int fd)
+{
+    Watch **link, *W;
+
+    for (link=&watches; (W=*link); link=&W->next) {
+        if (W->fd == fd) {
+            epoll_ctl (epfd, EPOLL_CTL_DEL, fd, NULL);
+            *link = W->next;
+            free (W);
+            return;
+        }
+    }
+}
+
+
+/* waits up to timeout ms (-1: forever) and dispatches whatever became
+ * ready; returns the number of sources dispatched */
+int event_poll (int timeout)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    Watch* W;
+    int i, n;
+
+    do {
+        n = epoll_wait (epfd, ev, MAX_EVENTS, timeout);
+    } while (n == -1 && errno == EINTR);
+
+    for (i=0; i<n; i++) {
+        /* a callback may have unwatched a later fd */
+        W = find_watch (ev[i].data.fd);
+        if (W)
+            W->fn (W->fd, ev[i].events, W->arg);
+    }
+
+    return n < 0 ? 0 : n;
+}
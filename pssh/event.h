@@ -0,0 +1,21 @@
+#ifndef _event_h_
+#define _event_h_
+
+#include <sys/epoll.h>
+
+/* The shell's event loop.
+ *
+ * SIGCHLD is blocked and read from a signalfd; whenever it is readable
+ * the registered reaper runs from event_poll(), in the main flow of
+ * control rather than in a signal handler.  Other descriptors (the
+ * terminal, for readline) can be watched alongside it. */
+
+typedef void (*EventFn) (int fd, unsigned int events, void* arg);
+
+int event_init (void (*reaper)(void));
+int event_reinit (void);
+int event_watch (int fd, unsigned int events, EventFn fn, void* arg);
+void event_unwatch (int fd);
+int event_poll (int timeout);
+
+#endif /* _event_h_ */
@@ -0,0 +1,424 @@
+/* Word expansion.
+ *
+ *   ~  ~user        at the start of a word: $HOME, or user's home
+ *   $NAME  ${NAME}  the environment variable, or nothing
+ *   $?  $$          the last exit status, the shell's pid
+ *   *  ?  [...]     the paths matching the word (see pattern.c)
+ *
+ * Nothing is expanded inside '...' and only $ inside "..." (see
+ * parse.c).  As in zsh, the value of a variable is taken as it is: it
+ * is neither split into words nor used as a pattern.  An unquoted word
+ * that comes to nothing is dropped; a pattern that matches nothing is
+ * left as it is, as in sh.  The targets of redirections and taps get
+ * ~ and $ but are never globbed.
+ *
+ * Expanding a line happens every time it runs, so what can be is done
+ * once, by expand_compile() when the line's plan is made (see plan.c):
+ * each marked word is split into parts (text, variables, ~), a marked
+ * word that turns out to hold nothing to expand (a~b, or $ alone)
+ * becomes plain text, and a pattern with no variable in it is compiled
+ * for good.  A line left with nothing to expand costs nothing more.
+ **********************************************************************/
+#include <ctype.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "builtin.h"
+#include "expand.h"
+#include "pattern.h"
+
+typedef enum {
+    PART_TEXT,
+    PART_VAR,
+    PART_STATUS,
+    PART_PID,
+    PART_HOME,
+} PartKind;
+
+typedef struct {
+    PartKind kind;
+    char* s;             /* TEXT: escaped text; VAR: the name; HOME: the user */
+} Part;
+
+typedef struct {
+    Part* part;
+    int npart;
+    int quoted;          /* kept when it comes to nothing */
+    int glob;            /* a wildcard in its text */
+    Pattern* G;          /* compiled, for a pattern without variables */
+    char* text;          /* G's text: the word if G matches nothing */
+} Word;
+
+typedef struct {
+    Word** argv;         /* NULL for a plain word */
+    Word** tee;
+    Word* errfile;
+} TaskWords;
+
+struct Expansion {
+    TaskWords* task;
+    Word* infile;
+    Word* outfile;
+    Word* herestring;
+    Arena* A;            /* everything above */
+};
+
+typedef struct {
+    char* s;
+    size_t len, cap;
+} Buf;
+
+
+static void buf_put (Buf* B, const char* s, size_t n)
+{
+    if (B->len + n + 1 > B->cap) {
+        B->cap = 2 * (B->len + n + 1);
+        B->s = realloc (B->s, B->cap);
+    }
+    memcpy (B->s + B->len, s, n);
+    B->len += n;
+    B->s[B->len] = '\0';
+}
+
+
+/* a value from outside the line: nothing in it is a wildcard */
+static void buf_put_literal (Buf* B, const char* s)
+{
+    const char esc = WORD_ESC;
+
+    for (; *s; s++) {
+        if (strchr ("\001*?[", *s))
+            buf_put (B, &esc, 1);
+        buf_put (B, s, 1);
+    }
+}
+
+
+static char* unescape (const char* s, Arena* A)
+{
+    char *d, *out = arena_alloc (A, strlen (s) + 1);
+
+    for (d=out; *s; s++) {
+        if (*s == WORD_ESC && s[1])
+            s++;
+        *d++ = *s;
+    }
+    *d = '\0';
+
+    return out;
+}
+
+
+/* the length of the variable reference at s (a '$'), or 0 if it is
+ * just a '$'; fills kind and the name */
+static size_t var_ref (const char* s, PartKind* kind, const char** name, size_t* len)
+{
+    const char* end;
+
+    *kind = PART_VAR;
+    *name = s + 1;
+
+    if (s[1] == '{') {
+        if (!(end = strchr (s + 2, '}')) || end == s + 2)
+            return 0;
+        *name = s + 2;
+        *len = end - *name;
+        if (*len == 1 && (**name == '?' || **name == '$'))
+            *kind = **name == '?' ? PART_STATUS : PART_PID;
+        else {
+            if (!isalpha ((unsigned char)**name) && **name != '_')
+                return 0;
+            for (s=*name; s<end; s++)
+                if (!isalnum ((unsigned char)*s) && *s != '_')
+                    return 0;
+        }
+        return end - (*name - 2) + 1;
+    }
+
+    if (s[1] == '?' || s[1] == '$') {
+        *kind = s[1] == '?' ? PART_STATUS : PART_PID;
+        return 2;
+    }
+
+    if (!isalpha ((unsigned char)s[1]) && s[1] != '_')
+        return 0;
+    for (end=s+1; isalnum ((unsigned char)*end) || *end == '_'; end++);
+    *len = end - *name;
+
+    return end - s;
+}
+
+
+static void add_part (Word* W, PartKind kind, const char* s, size_t n, Arena* A)
+{
+    Part* P = &W->part[W->npart++];
+
+    P->kind = kind;
+    P->s = arena_alloc (A, n + 1);
+    memcpy (P->s, s, n);
+    P->s[n] = '\0';
+}
+
+
+/* Splits a marked word into parts.  Returns NULL, having made w plain
+ * text in place, if there is nothing to expand in it after all */
+static Word* compile_word (char* w, Arena* A, int glob_ok)
+{
+    const char *s, *text, *name, *end;
+    PartKind kind;
+    size_t n, len;
+    Word* W;
+    int dynamic = 0;
+
+    if (*w != WORD_EXPAND && *w != WORD_EXPAND_QUOTED)
+        return NULL;
+
+    W = arena_alloc (A, sizeof(*W));
+    W->part = arena_alloc (A, (strlen (w) + 1) * sizeof(*W->part));
+    W->npart = 0;
+    W->quoted = *w == WORD_EXPAND_QUOTED;
+    W->glob = 0;
+    W->G = NULL;
+    W->text = NULL;
+
+    s = w + 1;
+    if (*s == '~') {
+        for (end=s+1; isalnum ((unsigned char)*end) || (*end && strchr ("_.-", *end)); end++);
+        if (!*end || *end == '/') {
+            add_part (W, PART_HOME, s + 1, end - (s + 1), A);
+            dynamic = 1;
+            s = end;
+        }
+    }
+
+    for (text=s; *s; ) {
+        if (*s == WORD_ESC && s[1]) {
+            s += 2;
+            continue;
+        }
+        if (*s == '$' && (n = var_ref (s, &kind, &name, &len))) {
+            if (s > text)
+                add_part (W, PART_TEXT, text, s - text, A);
+            add_part (W, kind, name, kind == PART_VAR ? len : 0, A);
+            dynamic = 1;
+            text = s += n;
+            continue;
+        }
+        if (strchr ("*?[", *s))
+            W->glob = glob_ok;
+        s++;
+    }
+    if (s > text || !W->npart)
+        add_part (W, PART_TEXT, text, s - text, A);
+
+    if (dynamic)
+        return W;
+
+    /* one part of text: a pattern, or plain after all */
+    text = W->part[0].s;
+    if (W->glob && (W->G = pattern_compile (text, A))) {
+        W->text = W->part[0].s;
+        return W;
+    }
+    /* no longer than w, which loses its mark */
+    s = unescape (text, A);
+    memcpy (w, s, strlen (s) + 1);
+
+    return NULL;
+}
+
+
+/* adds what W comes to to L */
+static void run_word (const Word* W, PathList* L)
+{
+    Buf B = { NULL, 0, 0 };
+    const struct passwd* pw;
+    const char* v;
+    char num[32];
+    Pattern* G;
+    int k;
+
+    if (W->G) {
+        if (!pattern_glob (W->G, L))
+            pathlist_add (L, unescape (W->text, L->A));
+        return;
+    }
+
+    buf_put (&B, "", 0);
+    for (k=0; k<W->npart; k++) {
+        const Part* P = &W->part[k];
+        switch (P->kind) {
+        case PART_TEXT:
+            buf_put (&B, P->s, strlen (P->s));
+            break;
+        case PART_VAR:
+            if ((v = getenv (P->s)))
+                buf_put_literal (&B, v);
+            break;
+        case PART_STATUS:
+        case PART_PID:
+            snprintf (num, sizeof(num), "%d",
+                      P->kind == PART_STATUS ? last_status : (int)getpid ());
+            buf_put (&B, num, strlen (num));
+            break;
+        case PART_HOME:
+            v = NULL;
+            if (!*P->s && !(v = getenv ("HOME")) && (pw = getpwuid (getuid ())))
+                v = pw->pw_dir;
+            else if (*P->s && (pw = getpwnam (P->s)))
+                v = pw->pw_dir;
+            if (v)
+                buf_put_literal (&B, v);
+            else {
+                buf_put (&B, "~", 1);
+                buf_put (&B, P->s, strlen (P->s));
+            }
+            break;
+        }
+    }
+
+    if (!W->glob || !(G = pattern_compile (B.s, L->A)) || !pattern_glob (G, L))
+        if (*B.s || W->quoted)
+            pathlist_add (L, unescape (B.s, L->A));
+
+    free (B.s);
+}
+
+
+/* a redirection target: one word, never globbed */
+static char* run_target (const Word* W, char* plain, PathList* L)
+{
+    if (!W)
+        return plain;
+
+    L->n = 0;
+    run_word (W, L);
+
+    return L->n ? L->v[0] : "";
+}
+
+
+static Word** compile_words (char** words, Arena* A, int glob_ok, int* any)
+{
+    Word** W;
+    int n;
+
+    for (n=0; words[n]; n++);
+    W = arena_alloc (A, (n + 1) * sizeof(*W));
+    for (n=0; words[n]; n++)
+        if ((W[n] = compile_word (words[n], A, glob_ok)))
+            *any = 1;
+
+    return W;
+}
+
+
+/* compiles what can be of P's expansions, making its plain words plain
+ * text; NULL if there are none left */
+Expansion* expand_compile (Parse* P)
+{
+    Arena* A = arena_new (1024);
+    Expansion* X = arena_alloc (A, sizeof(*X));
+    Task* T;
+    int t, any = 0;
+
+    X->A = A;
+    X->task = arena_alloc (A, P->ntasks * sizeof(*X->task));
+
+    for (t=0; t<P->ntasks; t++) {
+        T = &P->tasks[t];
+        X->task[t].argv = compile_words (T->argv, A, 1, &any);
+        X->task[t].tee = T->tee ? compile_words (T->tee, A, 0, &any) : NULL;
+        X->task[t].errfile = T->errfile ? compile_word (T->errfile, A, 0) : NULL;
+        any |= X->task[t].errfile != NULL;
+        T->cmd = T->argv[0];
+    }
+
+    X->infile = P->infile ? compile_word (P->infile, A, 0) : NULL;
+    X->outfile = P->outfile ? compile_word (P->outfile, A, 0) : NULL;
+    X->herestring = P->herestring ? compile_word (P->herestring, A, 0) : NULL;
+    any |= X->infile || X->outfile || X->herestring;
+
+    if (!any) {
+        arena_destroy (A);
+        return NULL;
+    }
+
+    return X;
+}
+
+
+/* a copy of L's strings, NULL terminated, in A */
+static char** to_argv (PathList* L, Arena* A)
+{
+    char** v = arena_alloc (A, (L->n + 1) * sizeof(*v));
+
+    memcpy (v, L->v, L->n * sizeof(*v));
+    v[L->n] = NULL;
+
+    return v;
+}
+
+
+Parse* expand_run (const Expansion* X, const Parse* P)
+{
+    Arena* A = arena_new (4096);
+    Parse* Q = arena_alloc (A, sizeof(*Q));
+    PathList L = { NULL, 0, 0, A };
+    const TaskWords* W;
+    Task* T;
+    int t, e;
+
+    *Q = *P;
+    Q->arena = A;
+    Q->tasks = arena_alloc (A, P->ntasks * sizeof(*Q->tasks));
+
+    for (t=0; t<P->ntasks; t++) {
+        W = &X->task[t];
+        T = &Q->tasks[t];
+        *T = P->tasks[t];
+
+        L.n = 0;
+        for (e=0; P->tasks[t].argv[e]; e++) {
+            if (W->argv[e])
+                run_word (W->argv[e], &L);
+            else
+                pathlist_add (&L, P->tasks[t].argv[e]);
+        }
+        if (!L.n) {
+            fprintf (stderr, "pssh: empty command\n");
+            free (L.v);
+            arena_destroy (A);
+            return NULL;
+        }
+        T->argv = to_argv (&L, A);
+        T->cmd = T->argv[0];
+
+        if (T->tee) {
+            for (e=0; P->tasks[t].tee[e]; e++);
+            T->tee = arena_alloc (A, (e + 1) * sizeof(*T->tee));
+            for (e=0; P->tasks[t].tee[e]; e++)
+                T->tee[e] = run_target (W->tee[e], P->tasks[t].tee[e], &L);
+            T->tee[e] = NULL;
+        }
+        T->errfile = run_target (W->errfile, T->errfile, &L);
+    }
+
+    Q->infile = run_target (X->infile, P->infile, &L);
+    Q->outfile = run_target (X->outfile, P->outfile, &L);
+    Q->herestring = run_target (X->herestring, P->herestring, &L);
+
+    free (L.v);
+    return Q;
+}
+
+
+void expand_destroy (Expansion* X)
+{
+    if (X)
+        arena_destroy (X->A);
+}
@@ -0,0 +1,20 @@
+#ifndef _expand_h_
+#define _expand_h_
+
+#include "parse.h"
+
+/* Expansion of the words of a parsed command line.
+ *
+ * expand_compile() does once what does not depend on the environment
+ * or the file system: it returns NULL, having turned every word of P
+ * into plain text, if nothing is left to expand.  expand_run() expands
+ * the words of P into a new Parse (sharing P's plain words), or prints
+ * why it cannot and returns NULL. */
+
+typedef struct Expansion Expansion;
+
+Expansion* expand_compile (Parse* P);
+Parse* expand_run (const Expansion* X, const Parse* P);
+void expand_destroy (Expansion* X);
+
+#endif /* _expand_h_ */
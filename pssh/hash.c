@@ -0,0 +1,268 @@
+/* Command hash table.
+ *
+ * Resolving a bare command name means probing every directory on $PATH
+ * with access(2).  The shell does that for every task of every command
+ * line, so the result is remembered here, keyed on the command name.
+ *
+ * An entry stays valid as long as:
+ *   - $PATH is the same string it was resolved against, and
+ *   - the directory it was found in has the same mtime.
+ *
+ * The directory is stat(2)'d at most once per epoch (one command line),
+ * so a hit costs one syscall instead of one per $PATH directory.
+ **********************************************************************/
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+
+#define HASH_BUCKETS 64
+
+typedef struct HashEntry {
+    char* name;
+    char* path;                 /* resolved absolute path */
+    char* dir;                  /* $PATH directory it was found in */
+    struct timespec mtime;      /* mtime of dir when resolved */
+    unsigned int hits;
+    unsigned int epoch;         /* epoch dir was last validated in */
+    struct HashEntry* next;
+} HashEntry;
+
+static HashEntry* table[HASH_BUCKETS];
+static char* hashed_path;       /* $PATH the table was built against */
+static unsigned int epoch = 1;
+
+
+static unsigned int hash_str (const char* s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    return h % HASH_BUCKETS;
+}
+
+
+static void entry_destroy (HashEntry* E)
+{
+    free (E->name);
+    free (E->path);
+    free (E->dir);
+    free (E);
+}
+
+
+void hash_reset ()
+{
+    HashEntry *E, *next;
+    int i;
+
+    for (i=0; i<HASH_BUCKETS; i++) {
+        for (E=table[i]; E; E=next) {
+            next = E->next;
+            entry_destroy (E);
+        }
+        table[i] = NULL;
+    }
+
+    free (hashed_path);
+    hashed_path = NULL;
+}
+
+
+/* Called once per command line; entries are revalidated against
+ * their directory's mtime at most once per epoch */
+void hash_new_epoch ()
+{
+    epoch++;
+}
+
+
+static int same_mtime (struct timespec* a, struct timespec* b)
+{
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+
+static int entry_valid (HashEntry* E)
+{
+    struct stat st;
+
+    if (E->epoch == epoch)
+        return 1;
+
+    if (stat (E->dir, &st) == -1 || !same_mtime (&st.st_mtim, &E->mtime))
+        return 0;
+
+    E->epoch = epoch;
+    return 1;
+}
+
+
+/* walks $PATH for cmd, returning a new entry or NULL if not found */
+static HashEntry* resolve (const char* cmd)
+{
+    char* dir;
+    char* tmp;
+    char* PATH;
+    char* state;
+    char probe[PATH_MAX];
+    struct stat st;
+    HashEntry* E = NULL;
+
+    if (!hashed_path)
+        return NULL;
+
+    PATH = strdup (hashed_path);
+
+    for (tmp=PATH; ; tmp=NULL) {
+        dir = strtok_r (tmp, ":", &state);
+        if (!dir)
+            break;
+
+        /* stat before probing so a concurrent change to the
+         * directory is seen as a newer mtime next time around */
+        if (stat (dir, &st) == -1)
+            continue;
+
+        if (snprintf (probe, PATH_MAX, "%s/%s", dir, cmd) >= PATH_MAX)
+            continue;
+
+        if (access (probe, X_OK) == 0) {
+            E = malloc (sizeof(*E));
+            E->name = strdup (cmd);
+            E->path = strdup (probe);
+            E->dir = strdup (dir);
+            E->mtime = st.st_mtim;
+            E->hits = 0;
+            E->epoch = epoch;
+            break;
+        }
+    }
+
+    free (PATH);
+    return E;
+}
+
+
+/* returns the full path cmd will be executed from, or NULL if cmd
+ * cannot be found.  The returned string is owned by the table. */
+const char* hash_lookup (const char* cmd)
+{
+    HashEntry **link, *E;
+    const char* PATH;
+    unsigned int h;
+
+    if (strchr (cmd, '/'))
+        return access (cmd, X_OK) == 0 ? cmd : NULL;
+
+    PATH = getenv ("PATH");
+    if (!PATH)
+        PATH = "";
+
+    if (!hashed_path || strcmp (PATH, hashed_path)) {
+        hash_reset ();
+        hashed_path = strdup (PATH);
+    }
+
+    h = hash_str (cmd);
+
+    for (link=&table[h]; (E=*link); link=&E->next) {
+        if (strcmp (E->name, cmd))
+            continue;
+
+        if (entry_valid (E)) {
+            E->hits++;
+            return E->path;
+        }
+
+        *link = E->next;
+        entry_destroy (E);
+        break;
+    }
+
+    E = resolve (cmd);
+    if (!E)
+        return NULL;
+
+    E->hits++;
+    E->next = table[h];
+    table[h] = E;
+
+    return E->path;
+}
+
+
+/* remembers path as the location of cmd (`hash -p path cmd`) */
+int hash_insert (const char* cmd, const char* path)
+{
+    HashEntry **link, *E;
+    struct stat st;
+    char* slash;
+    unsigned int h;
+
+    if (strchr (cmd, '/') || !(slash = strrchr (path, '/')))
+        return -1;
+
+    if (!hashed_path)
+        hashed_path = strdup (getenv ("PATH") ? getenv ("PATH") : "");
+
+    E = malloc (sizeof(*E));
+    E->name = strdup (cmd);
+    E->path = strdup (path);
+    E->dir = slash == path ? strdup ("/") : strndup (path, slash - path);
+    E->hits = 0;
+    E->epoch = epoch;
+
+    if (stat (E->dir, &st) == -1) {
+        entry_destroy (E);
+        return -1;
+    }
+    E->mtime = st.st_mtim;
+
+    h = hash_str (cmd);
+    for (link=&table[h]; *link; link=&(*link)->next) {
+        if (!strcmp ((*link)->name, cmd)) {
+            HashEntry* old = *link;
+            *link = old->next;
+            entry_destroy (old);
+            break;
+        }
+    }
+
+    E->next = table[h];
+    table[h] = E;
+
+    return 0;
+}
+
+
+/* prints the table like bash's `hash` (or `hash -l` if reusable) */
+void hash_list (FILE* out, int reusable)
+{
+    HashEntry* E;
+    int i, n = 0;
+
+    for (i=0; i<HASH_BUCKETS; i++) {
+        for (E=table[i]; E; E=E->next) {
+            if (!reusable && !n)
+                fprintf (out, "hits\tcommand\n");
+
+            if (reusable)
+                fprintf (out, "hash -p %s %s\n", E->path, E->name);
+            else
+                fprintf (out, "%4u\t%s\n", E->hits, E->path);
+            n++;
+        }
+    }
+
+    if (!n)
+        fprintf (out, "pssh: hash table empty\n");
+}
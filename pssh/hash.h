@@ -0,0 +1,19 @@
+#ifndef _hash_h_
+#define _hash_h_
+
+#include <stdio.h>
+
+/* Remembered command locations, a la bash's `hash`.
+ *
+ * hash_lookup() maps a command name to the absolute path it resolves to
+ * on $PATH, walking $PATH only the first time a name is seen.  Entries
+ * are dropped when $PATH changes or when the directory an entry was
+ * found in is modified. */
+
+const char* hash_lookup (const char* cmd);
+int hash_insert (const char* cmd, const char* path);
+void hash_new_epoch (void);
+void hash_reset (void);
+void hash_list (FILE* out, int reusable);
+
+#endif /* _hash_h_ */
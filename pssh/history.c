@@ -0,0 +1,393 @@
+/* Persistent command history.
+ *
+ * History lives in one append-only file, one command per line
+ * ($PSSH_HISTFILE, or ~/.pssh_history).  Every session appends with a
+ * single write() on an O_APPEND descriptor, so concurrent shells never
+ * tear each other's lines.
+ *
+ * The file is mmap()ed rather than read.  Startup only walks back from
+ * the end far enough to give readline the last HIST_RECENT commands for
+ * up-arrow; everything else is left to the page cache until a search
+ * needs it.  The first search indexes the whole file, and later ones
+ * only index what was appended since (by any session):
+ *
+ *   entries    start offset of every line, found with memchr()
+ *   trigrams   for each of TRI_BUCKETS hashed trigrams, the ascending
+ *              ids of the entries containing it
+ *
+ * A search for a string of three or more bytes walks the shortest
+ * posting list among its trigrams, newest first, and confirms each
+ * candidate with memmem(); shorter strings are scanned for directly.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#include <readline/history.h>
+
+#include "history.h"
+
+#define HIST_RECENT 1000
+#define TRI_BITS    16
+#define TRI_BUCKETS (1 << TRI_BITS)
+
+typedef struct {
+    uint32_t* ids;
+    uint32_t n;
+    uint32_t cap;
+} Posting;
+
+static int fd = -1;
+static char* map;
+static size_t mapped;
+
+static size_t* entries;         /* entries[i]: offset of line i; one extra
+                                   slot holds the end of the last line */
+static long nentries;
+static long cap_entries;
+static long ntrigram;           /* entries indexed in trigrams[] */
+static Posting* trigrams;
+
+static char* last_added;
+
+/* Ctrl-R state: the query, and the entry it last put on the line */
+static char* search_query;
+static long search_at;
+static char* search_shown;
+
+
+static unsigned int tri_bucket (const unsigned char* s)
+{
+    uint32_t key = s[0] << 16 | s[1] << 8 | s[2];
+
+    return (key * 2654435761u) >> (32 - TRI_BITS);
+}
+
+
+/* maps whatever the file has grown to since the last call */
+static int remap ()
+{
+    struct stat st;
+    void* m;
+
+    if (fd == -1 || fstat (fd, &st) == -1)
+        return -1;
+
+    if ((size_t) st.st_size < mapped) {
+        /* truncated by someone else: start over */
+        munmap (map, mapped);
+        map = NULL;
+        mapped = 0;
+        nentries = ntrigram = 0;
+        if (trigrams)
+            for (int i=0; i<TRI_BUCKETS; i++)
+                trigrams[i].n = 0;
+    }
+
+    if ((size_t) st.st_size == mapped)
+        return 0;
+
+    if (map)
+        m = mremap (map, mapped, st.st_size, MREMAP_MAYMOVE);
+    else
+        m = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (m == MAP_FAILED)
+        return -1;
+
+    map = m;
+    mapped = st.st_size;
+
+    return 0;
+}
+
+
+static void entry_push (size_t off)
+{
+    if (nentries + 2 > cap_entries) {
+        cap_entries = cap_entries ? cap_entries * 2 : 4096;
+        entries = realloc (entries, cap_entries * sizeof(*entries));
+    }
+    entries[nentries++] = off;
+}
+
+
+/* indexes the line offsets of every complete line not yet seen */
+static void sync_entries ()
+{
+    size_t pos = nentries ? entries[nentries] : 0;
+    char* nl;
+
+    if (remap () == -1)
+        return;
+
+    while (pos < mapped && (nl = memchr (map + pos, '\n', mapped - pos))) {
+        entry_push (pos);
+        pos = nl - map + 1;
+    }
+
+    if (entries)
+        entries[nentries] = pos;
+}
+
+
+static void posting_add (Posting* p, uint32_t id)
+{
+    /* an entry repeating a trigram is listed once */
+    if (p->n && p->ids[p->n - 1] == id)
+        return;
+
+    if (p->n == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 4;
+        p->ids = realloc (p->ids, p->cap * sizeof(*p->ids));
+    }
+    p->ids[p->n++] = id;
+}
+
+
+static void sync_trigrams ()
+{
+    const unsigned char *s, *end;
+
+    sync_entries ();
+
+    if (!trigrams)
+        trigrams = calloc (TRI_BUCKETS, sizeof(*trigrams));
+
+    for (; ntrigram < nentries; ntrigram++) {
+        s = (unsigned char*) map + entries[ntrigram];
+        end = (unsigned char*) map + entries[ntrigram + 1] - 1;
+        for (; s + 3 <= end; s++)
+            posting_add (&trigrams[tri_bucket (s)], ntrigram);
+    }
+}
+
+
+/* entry id's text, not NUL terminated */
+static const char* entry_text (long id, size_t* len)
+{
+    *len = entries[id + 1] - entries[id] - 1;
+    return map + entries[id];
+}
+
+
+static int entry_matches (long id, const char* q, size_t qlen)
+{
+    size_t len;
+    const char* s = entry_text (id, &len);
+
+    return memmem (s, len, q, qlen) != NULL;
+}
+
+
+/* newest entry at or before id `from` containing q, or -1 */
+long hist_search (const char* q, long from)
+{
+    size_t qlen = strlen (q);
+    Posting *p, *best = NULL;
+    long lo, hi, mid;
+    size_t i;
+
+    sync_trigrams ();
+
+    if (from >= nentries)
+        from = nentries - 1;
+
+    if (qlen < 3) {
+        for (; from >= 0; from--)
+            if (entry_matches (from, q, qlen))
+                return from;
+        return -1;
+    }
+
+    for (i=0; i+3 <= qlen; i++) {
+        p = &trigrams[tri_bucket ((const unsigned char*) q + i)];
+        if (!best || p->n < best->n)
+            best = p;
+    }
+
+    /* last posting <= from */
+    lo = 0;
+    hi = best->n;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (best->ids[mid] <= from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (lo--; lo >= 0; lo--)
+        if (entry_matches (best->ids[lo], q, qlen))
+            return best->ids[lo];
+
+    return -1;
+}
+
+
+static void print_entry (FILE* out, long id)
+{
+    size_t len;
+    const char* s = entry_text (id, &len);
+
+    fprintf (out, "%6ld  %.*s\n", id + 1, (int) len, s);
+}
+
+
+/* prints the last n entries (all, if n < 0) */
+void hist_print (FILE* out, long n)
+{
+    long i;
+
+    sync_entries ();
+
+    i = n < 0 || n > nentries ? 0 : nentries - n;
+    for (; i<nentries; i++)
+        print_entry (out, i);
+}
+
+
+/* prints every entry containing q, oldest first */
+void hist_grep (FILE* out, const char* q)
+{
+    long *hits = NULL, nhits = 0, cap = 0, id;
+
+    for (id=hist_search (q, LONG_MAX); id >= 0; id=hist_search (q, id - 1)) {
+        if (nhits == cap) {
+            cap = cap ? cap * 2 : 64;
+            hits = realloc (hits, cap * sizeof(*hits));
+        }
+        hits[nhits++] = id;
+    }
+
+    while (nhits--)
+        print_entry (out, hits[nhits]);
+
+    free (hits);
+}
+
+
+/* Ctrl-R: the first press searches for what is on the line, each
+ * further press for an older match of the same text */
+static int rl_search (int count, int key)
+{
+    long id, from = LONG_MAX;
+    const char* s;
+    size_t len;
+
+    if (search_shown && !strcmp (rl_line_buffer, search_shown))
+        from = search_at - 1;
+    else {
+        free (search_query);
+        search_query = strdup (rl_line_buffer);
+    }
+
+    id = from < 0 ? -1 : hist_search (search_query, from);
+    if (id < 0) {
+        rl_ding ();
+        return 0;
+    }
+
+    s = entry_text (id, &len);
+    free (search_shown);
+    search_shown = strndup (s, len);
+    search_at = id;
+
+    rl_replace_line (search_shown, 0);
+    rl_point = rl_end;
+
+    return 0;
+}
+
+
+/* hands readline the newest HIST_RECENT commands, found by walking
+ * back from the end of the file */
+static void load_recent ()
+{
+    const char *end, *s, *start[HIST_RECENT];
+    int n = 0;
+
+    if (!mapped)
+        return;
+
+    end = map + mapped;
+    if (end[-1] != '\n') {
+        /* a line still being written by another session */
+        while (end > map && end[-1] != '\n')
+            end--;
+    }
+
+    /* blank lines (a partial write can leave one) are not commands */
+    for (s=end-1; s > map && n < HIST_RECENT; s--)
+        if (s[-1] == '\n' && *s != '\n')
+            start[n++] = s;
+    if (s == map && n < HIST_RECENT && end > map && *map != '\n')
+        start[n++] = map;
+
+    while (n--) {
+        s = start[n];
+        char* line = strndup (s, (const char*) memchr (s, '\n', end - s) - s);
+        add_history (line);
+        if (!n)
+            last_added = line;
+        else
+            free (line);
+    }
+}
+
+
+/* opens (creating if need be) the history file at path and loads the
+ * recent commands into readline; returns -1 if it cannot be opened */
+int hist_open (const char* path)
+{
+    fd = open (path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return -1;
+
+    if (remap () == -1) {
+        close (fd);
+        fd = -1;
+        return -1;
+    }
+
+    load_recent ();
+
+    /* after readline has read inputrc, or its defaults win */
+    rl_initialize ();
+    rl_bind_key ('R' & 0x1f, rl_search);
+
+    return 0;
+}
+
+
+/* records line, unless it is blank or repeats the previous command */
+void hist_add (const char* line)
+{
+    size_t len = strlen (line);
+    char* buf;
+    ssize_t unused;
+
+    if (fd == -1 || !line[strspn (line, " \t")] || strchr (line, '\n'))
+        return;
+    if (last_added && !strcmp (line, last_added))
+        return;
+
+    add_history (line);
+    free (last_added);
+    last_added = strdup (line);
+
+    /* one write() per line: O_APPEND makes it atomic across sessions */
+    buf = malloc (len + 1);
+    memcpy (buf, line, len);
+    buf[len] = '\n';
+    unused = write (fd, buf, len + 1);
+    (void) unused;
+    free (buf);
+}
@@ -0,0 +1,18 @@
+#ifndef _history_h_
+#define _history_h_
+
+#include <stdio.h>
+
+/* Persistent, append-only command history with indexed search.
+ *
+ * hist_open() binds Ctrl-R to a search of the whole file; the rest of
+ * the shell only needs hist_add() for every interactive command line.
+ * Entry ids count from 0, oldest first. */
+
+int hist_open (const char* path);
+void hist_add (const char* line);
+long hist_search (const char* q, long from);
+void hist_print (FILE* out, long n);
+void hist_grep (FILE* out, const char* q);
+
+#endif /* _history_h_ */
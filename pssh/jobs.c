@@ -0,0 +1,545 @@
+/* Job table.
+ *
+ * Jobs live in a growable array indexed by job number.  New jobs are
+ * numbered one past the highest number in use, so numbers are reused
+ * the way bash reuses them once the jobs above them are gone.  %+ and
+ * %- follow the most recently started/stopped jobs.
+ *
+ * Every process of every job is also entered in an open-addressed
+ * pid -> (job, process) index, so the reaper finds the owner of a pid
+ * in constant time no matter how many jobs are running.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "trace.h"
+
+typedef struct {
+    pid_t pid;           /* 0: empty */
+    Job* job;
+    unsigned int idx;    /* into job->procs */
+} PidEntry;
+
+static Job** slots;          /* indexed by job id; slot 0 is unused */
+static int nslots;
+static int top;              /* highest job id in use */
+static unsigned int njobs;
+static unsigned long serials;  /* last Job::serial given out */
+
+static Job* current;         /* %+ */
+static Job* previous;        /* %- */
+
+static PidEntry* pids;       /* capacity is a power of two */
+static unsigned int npids_cap;
+static unsigned int npids_used;
+
+
+static unsigned int pid_home (pid_t pid)
+{
+    return ((unsigned int)pid * 2654435761u) & (npids_cap - 1);
+}
+
+
+static PidEntry* pid_slot (pid_t pid)
+{
+    unsigned int i;
+
+    if (!npids_cap)
+        return NULL;
+
+    for (i=pid_home (pid); pids[i].pid; i=(i+1) & (npids_cap-1))
+        if (pids[i].pid == pid)
+            return &pids[i];
+
+    return NULL;
+}
+
+
+static void pid_insert (pid_t pid, Job* J, unsigned int idx);
+
+static void pid_grow ()
+{
+    PidEntry* old = pids;
+    unsigned int i, old_cap = npids_cap;
+
+    npids_cap = old_cap ? old_cap * 2 : 64;
+    pids = calloc (npids_cap, sizeof(*pids));
+    npids_used = 0;
+
+    for (i=0; i<old_cap; i++)
+        if (old[i].pid)
+            pid_insert (old[i].pid, old[i].job, old[i].idx);
+
+    free (old);
+}
+
+
+static void pid_insert (pid_t pid, Job* J, unsigned int idx)
+{
+    unsigned int i;
+
+    /* keep the load factor at or below 1/2 */
+    if ((npids_used + 1) * 2 > npids_cap)
+        pid_grow ();
+
+    for (i=pid_home (pid); pids[i].pid; i=(i+1) & (npids_cap-1));
+
+    pids[i].pid = pid;
+    pids[i].job = J;
+    pids[i].idx = idx;
+    npids_used++;
+}
+
+
+/* linear probing removal: shift later entries of the cluster back
+ * so lookups never need tombstones */
+static void pid_remove (pid_t pid)
+{
+    PidEntry* E = pid_slot (pid);
+    unsigned int i, j, k, mask = npids_cap - 1;
+
+    if (!E)
+        return;
+
+    i = E - pids;
+    for (j=(i+1) & mask; pids[j].pid; j=(j+1) & mask) {
+        k = pid_home (pids[j].pid);
+        if ((i < j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        pids[i] = pids[j];
+        i = j;
+    }
+
+    pids[i].pid = 0;
+    npids_used--;
+}
+
+
+/* creates an empty job with room for nprocs processes under the next
+ * free job number */
+Job* job_new (const char* name, unsigned int nprocs)
+{
+    Job* J;
+    int id = top + 1;
+
+    if (id >= nslots) {
+        int n = nslots ? nslots * 2 : 16;
+        slots = realloc (slots, n * sizeof(*slots));
+        memset (slots + nslots, 0, (n - nslots) * sizeof(*slots));
+        nslots = n;
+    }
+
+    J = malloc (sizeof(*J));
+    J->id = id;
+    J->serial = ++serials;
+    J->name = strdup (name);
+    J->procs = calloc (nprocs, sizeof(*J->procs));
+    J->nprocs = 0;
+    J->nlive = 0;
+    J->pgid = 0;
+    J->status = BG;
+    J->isFG = false;
+    J->timed = false;
+    J->cgroup = NULL;
+    J->edges = NULL;
+    J->nedges = 0;
+    clock_gettime (CLOCK_MONOTONIC, &J->start);
+
+    slots[id] = J;
+    top = id;
+    njobs++;
+
+    return J;
+}
+
+
+/* appends a launched process to J; the first one leads the group */
+void job_add_proc (Job* J, pid_t pid, const char* cmd)
+{
+    Process* p = &J->procs[J->nprocs];
+
+    p->pid = pid;
+    p->cmd = strdup (cmd);
+    p->state = PROC_RUNNING;
+    p->status = 0;
+    memset (&p->usage, 0, sizeof(p->usage));
+
+    if (!J->nprocs)
+        J->pgid = pid;
+
+    /* a track per job, a row per process */
+    if (tracing) {
+        char name[TRACE_ARG];
+        if (!J->nprocs) {
+            snprintf (name, sizeof(name), "[%d] %s", J->id, J->name);
+            trace_track (J->pgid, 0, name);
+        }
+        trace_track (J->pgid, pid, cmd);
+        trace_begin (J->pgid, pid, "running");
+    }
+
+    pid_insert (pid, J, J->nprocs);
+    J->nprocs++;
+    J->nlive++;
+}
+
+
+/* picks the most recent job other than current to become %- */
+static Job* most_recent_other ()
+{
+    int id;
+
+    for (id=top; id>0; id--)
+        if (slots[id] && slots[id] != current)
+            return slots[id];
+
+    return NULL;
+}
+
+
+void job_destroy (Job* J)
+{
+    unsigned int i;
+
+    for (i=0; i<J->nprocs; i++) {
+        if (J->procs[i].state != PROC_DONE)
+            pid_remove (J->procs[i].pid);
+        free (J->procs[i].cmd);
+    }
+
+    slots[J->id] = NULL;
+    njobs--;
+    while (top > 0 && !slots[top])
+        top--;
+
+    if (J == current) {
+        current = previous;
+        previous = NULL;
+    }
+    if (J == previous)
+        previous = NULL;
+    if (!previous)
+        previous = most_recent_other ();
+
+    cg_destroy (J->cgroup);
+    for (i=0; i<J->nedges; i++) {
+        free (J->edges[i].from);
+        free (J->edges[i].to);
+    }
+    free (J->edges);
+    free (J->name);
+    free (J->procs);
+    free (J);
+}
+
+
+void job_destroy_all ()
+{
+    Job* J;
+
+    while ((J = job_next (NULL)))
+        job_destroy (J);
+}
+
+
+Job* job_get (int id)
+{
+    if (id <= 0 || id > top)
+        return NULL;
+
+    return slots[id];
+}
+
+
+/* returns the job owning pid (and the process entry through proc),
+ * or NULL if pid is not a live process of any job */
+Job* job_find_pid (pid_t pid, Process** proc)
+{
+    PidEntry* E = pid_slot (pid);
+
+    if (!E)
+        return NULL;
+
+    if (proc)
+        *proc = &E->job->procs[E->idx];
+
+    return E->job;
+}
+
+
+/* records a wait status (and, for an exit, the resource usage)
+ * reported by wait4() for proc */
+void job_update (Job* J, Process* proc, int status, struct rusage* ru)
+{
+    char why[32];
+
+    if (tracing) {
+        if (WIFEXITED (status))
+            snprintf (why, sizeof(why), "exit %d", WEXITSTATUS (status));
+        else if (WIFSIGNALED (status))
+            snprintf (why, sizeof(why), "signal %d", WTERMSIG (status));
+        else
+            *why = '\0';
+        trace_end (J->pgid, proc->pid, why);
+        if (WIFSTOPPED (status) || WIFCONTINUED (status))
+            trace_begin (J->pgid, proc->pid, WIFSTOPPED (status) ? "stopped" : "running");
+    }
+
+    if (WIFCONTINUED (status)) {
+        proc->state = PROC_RUNNING;
+        J->status = J->isFG ? FG : BG;
+    }
+    else if (WIFSTOPPED (status)) {
+        proc->state = PROC_STOPPED;
+        J->status = STOPPED;
+        J->isFG = false;
+        job_set_current (J);
+    }
+    else {
+        proc->state = PROC_DONE;
+        proc->status = status;
+        proc->usage = *ru;
+        clock_gettime (CLOCK_MONOTONIC, &proc->end);
+        pid_remove (proc->pid);
+        if (--J->nlive == 0) {
+            J->status = TERM;
+            J->end = proc->end;
+        }
+    }
+}
+
+
+/* resolves %n, %+, %%, %- and %prefix job specs */
+Job* job_parse_spec (const char* spec)
+{
+    char* end;
+    long id;
+    int i;
+
+    if (!spec || spec[0] != '%')
+        return NULL;
+
+    spec++;
+
+    if (!*spec || !strcmp (spec, "+") || !strcmp (spec, "%"))
+        return current;
+
+    if (!strcmp (spec, "-"))
+        return previous;
+
+    id = strtol (spec, &end, 10);
+    if (!*end)
+        return job_get (id);
+
+    for (i=top; i>0; i--)
+        if (slots[i] && !strncmp (slots[i]->name, spec, strlen (spec)))
+            return slots[i];
+
+    return NULL;
+}
+
+
+/* iterates jobs in job number order; start with J = NULL */
+Job* job_next (Job* J)
+{
+    int id;
+
+    for (id=J ? J->id + 1 : 1; id<=top; id++)
+        if (slots[id])
+            return slots[id];
+
+    return NULL;
+}
+
+
+unsigned int job_count ()
+{
+    return njobs;
+}
+
+
+void job_set_current (Job* J)
+{
+    if (J == current)
+        return;
+
+    previous = current;
+    current = J;
+}
+
+
+/* '+' for the current job, '-' for the previous one, ' ' otherwise */
+char job_mark (Job* J)
+{
+    return J == current ? '+' : J == previous ? '-' : ' ';
+}
+
+
+/* exit status of a finished job, as $? would report it: that of the
+ * last stage, or 128+signal if it was killed */
+int job_exit_status (Job* J)
+{
+    int status;
+
+    if (!J->nprocs)
+        return 0;
+
+    status = J->procs[J->nprocs-1].status;
+
+    if (WIFSIGNALED (status))
+        return 128 + WTERMSIG (status);
+
+    return WEXITSTATUS (status);
+}
+
+
+static const char* proc_states[] = {
+    "Running",
+    "Stopped",
+    "Done",
+};
+
+
+/* the `jobs -l` listing of J: one line per process */
+void job_print_pids (Job* J, FILE* out)
+{
+    unsigned int i;
+
+    for (i=0; i<J->nprocs; i++) {
+        if (i == 0)
+            fprintf (out, "[%d] %c ", J->id, job_mark (J));
+        else
+            fprintf (out, "      ");
+        fprintf (out, "%-7d %-8s %s\n", J->procs[i].pid,
+                 proc_states[J->procs[i].state], J->procs[i].cmd);
+    }
+}
+
+
+static double elapsed (struct timespec* from, struct timespec* to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+
+static double tv_secs (struct timeval* tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+
+/* CPU times and peak RSS (KiB) of a process that is still running */
+static void live_usage (pid_t pid, double* user, double* sys, long* maxrss)
+{
+    char path[64], buf[1024], *p;
+    unsigned long ut = 0, st = 0;
+    FILE* f;
+    ssize_t n;
+    int fd;
+
+    *user = *sys = 0;
+    *maxrss = 0;
+
+    snprintf (path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fd = open (path, O_RDONLY | O_CLOEXEC)) != -1) {
+        n = read (fd, buf, sizeof(buf) - 1);
+        close (fd);
+        buf[n > 0 ? n : 0] = '\0';
+        /* fields after the parenthesised command name; utime is 14th */
+        if ((p = strrchr (buf, ')')))
+            sscanf (p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &ut, &st);
+        *user = (double) ut / sysconf (_SC_CLK_TCK);
+        *sys = (double) st / sysconf (_SC_CLK_TCK);
+    }
+
+    snprintf (path, sizeof(path), "/proc/%d/status", pid);
+    if ((f = fopen (path, "re"))) {
+        while (fgets (buf, sizeof(buf), f))
+            if (sscanf (buf, "VmHWM: %ld", maxrss) == 1)
+                break;
+        fclose (f);
+    }
+}
+
+
+/* per-stage real/user/sys/maxrss of J, as printed by `time` and
+ * `jobs -v`; stages still running are sampled from /proc.  With total,
+ * a summary line for the whole job follows. */
+void job_print_usage (Job* J, FILE* out, bool total)
+{
+    struct timespec now;
+    double real, user, sys, sum_user = 0, sum_sys = 0;
+    long maxrss, max_maxrss = 0;
+    unsigned int i;
+    Process* p;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    fprintf (out, "%-6s %-7s %9s %9s %9s %9s  %s\n",
+             "stage", "pid", "real", "user", "sys", "maxrss", "command");
+
+    for (i=0; i<J->nprocs; i++) {
+        p = &J->procs[i];
+
+        if (p->state == PROC_DONE) {
+            real = elapsed (&J->start, &p->end);
+            user = tv_secs (&p->usage.ru_utime);
+            sys = tv_secs (&p->usage.ru_stime);
+            maxrss = p->usage.ru_maxrss;
+        } else {
+            real = elapsed (&J->start, &now);
+            live_usage (p->pid, &user, &sys, &maxrss);
+        }
+
+        sum_user += user;
+        sum_sys += sys;
+        if (maxrss > max_maxrss)
+            max_maxrss = maxrss;
+
+        fprintf (out, "%-6u %-7d %8.3fs %8.3fs %8.3fs %8ldK  %s\n",
+                 i + 1, p->pid, real, user, sys, maxrss, p->cmd);
+    }
+
+    if (total) {
+        real = elapsed (&J->start, J->status == TERM ? &J->end : &now);
+        fprintf (out, "%-6s %-7s %8.3fs %8.3fs %8.3fs %8ldK\n",
+                 "total", "", real, sum_user, sum_sys, max_maxrss);
+    }
+
+    if (J->cgroup)
+        cg_print (J->cgroup, out);
+    if (J->edges)
+        job_print_pipes (J, out);
+}
+
+
+/* one line per instrumented pipe: throughput, how full it ran, and
+ * how long each side was held up by the other */
+void job_print_pipes (Job* J, FILE* out)
+{
+    struct timespec now;
+    const PipeStats* S;
+    double secs, fill;
+    unsigned int i;
+    char edge[64];
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    secs = elapsed (&J->start, J->status == TERM ? &J->end : &now);
+
+    fprintf (out, "%-5s %-24s %10s %10s %6s %10s %10s\n",
+            "pipe", "stages", "MB/s", "bytes", "fill", "wr-block", "rd-block");
+    for (i=0; i<J->nedges; i++) {
+        S = &J->edges[i].stats;
+        snprintf (edge, sizeof(edge), "%s -> %s", J->edges[i].from, J->edges[i].to);
+        fill = S->samples && S->capacity > 0 ?
+               100.0 * S->fill / S->samples / S->capacity : 0;
+        fprintf (out, "%-5u %-24s %10.1f %10llu %5.0f%% %9.3fs %9.3fs\n",
+                 i + 1, edge, secs > 0 ? S->bytes / 1e6 / secs : 0.0,
+                 S->bytes, fill, S->full, S->starved);
+    }
+}
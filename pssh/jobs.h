@@ -0,0 +1,78 @@
+#ifndef _jobs_h_
+#define _jobs_h_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "cgroup.h"
+#include "mover.h"
+
+typedef enum {
+    STOPPED,
+    TERM,       /* every process has exited */
+    BG,
+    FG,
+} JobStatus;
+
+typedef enum {
+    PROC_RUNNING,
+    PROC_STOPPED,
+    PROC_DONE,
+} ProcState;
+
+typedef struct {
+    pid_t pid;
+    char* cmd;           /* argv[0] of the stage */
+    ProcState state;
+    int status;          /* wait status, once PROC_DONE */
+    struct timespec end; /* when it was reaped */
+    struct rusage usage; /* from wait4(), once PROC_DONE */
+} Process;
+
+typedef struct {
+    char* from;          /* argv[0] of the stages either side */
+    char* to;
+    PipeStats stats;
+} Edge;
+
+typedef struct {
+    int id;              /* job number, as in %1 */
+    unsigned long serial;    /* unlike id, never reused */
+    char* name;
+    Process* procs;      /* one per pipeline stage, in order */
+    unsigned int nprocs;
+    unsigned int nlive;  /* processes that have not exited */
+    pid_t pgid;
+    JobStatus status;
+    bool isFG;
+    bool timed;          /* `time` prefix: report usage when done */
+    struct timespec start;
+    struct timespec end;     /* when the last process was reaped */
+    CGroup* cgroup;      /* from `limit`, or NULL */
+    Edge* edges;         /* instrumented pipes (`pipes -v`), or NULL */
+    unsigned int nedges;
+} Job;
+
+Job* job_new (const char* name, unsigned int nprocs);
+void job_add_proc (Job* J, pid_t pid, const char* cmd);
+void job_update (Job* J, Process* proc, int status, struct rusage* ru);
+void job_destroy (Job* J);
+void job_destroy_all (void);
+
+Job* job_get (int id);
+Job* job_find_pid (pid_t pid, Process** proc);
+Job* job_parse_spec (const char* spec);
+Job* job_next (Job* J);
+unsigned int job_count (void);
+
+void job_set_current (Job* J);
+char job_mark (Job* J);
+int job_exit_status (Job* J);
+void job_print_pids (Job* J, FILE* out);
+void job_print_usage (Job* J, FILE* out, bool total);
+void job_print_pipes (Job* J, FILE* out);
+
+#endif /* _jobs_h_ */
@@ -0,0 +1,515 @@
+/* In-shell data movers.
+ *
+ * A mover copies everything readable from one descriptor to any number
+ * of files plus one forward descriptor (the next pipeline stage, or the
+ * shell's stdout), without a tee(1) process and without the data
+ * passing through user space where the kernel allows it:
+ *
+ *   pipe source     splice() a chunk into a private pipe, tee() it into
+ *                   a second private pipe and splice() that to each file,
+ *                   then splice() the original on to the forward fd
+ *   file source     copy_file_range() to each file, sendfile() forward
+ *   anything else   read()/write()
+ *
+ * Any leg the kernel refuses (a terminal, an O_APPEND file, a file
+ * system without copy_file_range) falls back to read()/write() on its
+ * own.  A mover either runs to EOF in the caller (the tee builtin) or
+ * is driven from the event loop, one chunk per wakeup, for `|>` taps in
+ * a pipeline; a forward pipe that is full parks the mover on EPOLLOUT
+ * so a slow downstream stage never blocks the shell.
+ *
+ * An event-driven mover can also keep PipeStats on the pipe it feeds:
+ * bytes through it, how full it was at each step (FIONREAD works on a
+ * write end too), and how long the mover sat waiting on either side.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "event.h"
+#include "mover.h"
+
+#define CHUNK      65536            /* one default pipe buffer */
+#define FILE_CHUNK (1 << 20)
+
+struct Mover {
+    int in;
+    int fwd;             /* where data carries on to, -1: nowhere */
+    int* files;
+    char* file_plain;    /* file refused splice(): write() to it */
+    int nfiles;
+    int S[2];            /* taken off in, not yet forwarded */
+    int T[2];            /* copy of S on its way to a file */
+    size_t pending;      /* bytes in S not yet forwarded */
+    int plain;           /* in refused splice() */
+    int fwd_plain;       /* fwd refused splice() */
+    int fwd_dead;        /* reader of fwd went away: stop, as tee(1) does */
+    unsigned long job;   /* serial of the job it belongs to, or 0 */
+    PipeStats* stats;    /* or NULL */
+    double parked;       /* when it last parked on fwd or ran dry, or 0 */
+    char* buf;           /* for the read()/write() fallbacks */
+    struct Mover* next;
+};
+
+static Mover* movers;
+
+
+static int fallback (int err)
+{
+    return err == EINVAL || err == EXDEV || err == EBADF ||
+           err == ENOSYS || err == EOPNOTSUPP;
+}
+
+
+static char* buffer (Mover* M)
+{
+    if (!M->buf)
+        M->buf = malloc (CHUNK);
+
+    return M->buf;
+}
+
+
+static int write_all (int fd, const char* p, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = write (fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+
+static void close_pipe (int p[2])
+{
+    if (p[0] != -1) {
+        close (p[0]);
+        close (p[1]);
+    }
+}
+
+
+/* takes ownership of in, fwd (may be -1) and the nfiles descriptors in
+ * files, which must have been malloc()ed */
+Mover* mover_new (int in, int fwd, int* files, int nfiles)
+{
+    Mover* M = calloc (1, sizeof(*M));
+
+    M->in = in;
+    M->fwd = fwd;
+    M->files = files;
+    M->nfiles = nfiles;
+    M->file_plain = calloc (nfiles ? nfiles : 1, 1);
+    M->S[0] = M->S[1] = -1;
+    M->T[0] = M->T[1] = -1;
+    M->job = 0;
+
+    if (pipe2 (M->S, O_CLOEXEC) == -1)
+        M->plain = 1;
+    else if (nfiles && pipe2 (M->T, O_CLOEXEC) == -1) {
+        close_pipe (M->S);
+        M->S[0] = M->S[1] = -1;
+        M->plain = 1;
+    }
+
+    return M;
+}
+
+
+static void mover_free (Mover* M)
+{
+    int i;
+
+    close (M->in);
+    if (M->fwd != -1)
+        close (M->fwd);
+    for (i=0; i<M->nfiles; i++)
+        close (M->files[i]);
+    close_pipe (M->S);
+    close_pipe (M->T);
+
+    free (M->files);
+    free (M->file_plain);
+    free (M->buf);
+    free (M);
+}
+
+
+/* moves the first len bytes of T to file i */
+static void drain_copy (Mover* M, int i, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if (M->file_plain[i]) {
+            n = read (M->T[0], buffer (M), len < CHUNK ? len : CHUNK);
+            if (n > 0)
+                write_all (M->files[i], M->buf, n);
+        } else {
+            n = splice (M->T[0], NULL, M->files[i], NULL, len, SPLICE_F_MOVE);
+            if (n == -1 && fallback (errno)) {
+                M->file_plain[i] = 1;
+                continue;
+            }
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        len -= n;
+    }
+}
+
+
+/* passes what is in S on; returns -1 if fwd is a full pipe and the
+ * caller asked not to block */
+static int forward (Mover* M, unsigned int flags)
+{
+    ssize_t n;
+
+    while (M->pending) {
+        if (M->fwd == -1 || M->fwd_dead || M->fwd_plain) {
+            n = read (M->S[0], buffer (M), M->pending < CHUNK ? M->pending : CHUNK);
+            if (n > 0 && M->fwd != -1 && !M->fwd_dead &&
+                write_all (M->fwd, M->buf, n) == -1)
+                M->fwd_dead = 1;
+        } else {
+            n = splice (M->S[0], NULL, M->fwd, NULL, M->pending,
+                        SPLICE_F_MOVE | flags);
+            if (n == -1 && errno == EAGAIN)
+                return -1;
+            if (n == -1 && fallback (errno)) {
+                M->fwd_plain = 1;
+                continue;
+            }
+            if (n == -1 && errno != EINTR) {
+                M->fwd_dead = 1;
+                continue;
+            }
+        }
+        if (n > 0) {
+            M->pending -= n;
+            if (M->stats)
+                M->stats->bytes += n;
+        }
+    }
+
+    return 0;
+}
+
+
+/* source that cannot be spliced from */
+static ssize_t step_plain (Mover* M)
+{
+    ssize_t n;
+    int i;
+
+    do {
+        n = read (M->in, buffer (M), CHUNK);
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0)
+        return n;
+
+    for (i=0; i<M->nfiles; i++)
+        write_all (M->files[i], M->buf, n);
+
+    if (M->fwd != -1 && write_all (M->fwd, M->buf, n) == -1)
+        M->fwd_dead = 1;
+    else if (M->stats)
+        M->stats->bytes += n;
+
+    return M->fwd_dead ? 0 : n;
+}
+
+
+/* one chunk through the private pipes.  Returns bytes taken off in,
+ * 0 at EOF, -1 if in is empty (non-blocking) or failed, and -2 if the
+ * chunk is still waiting on a full forward pipe */
+static ssize_t step (Mover* M, unsigned int flags)
+{
+    ssize_t n, m;
+    int i;
+
+    if (M->plain)
+        return step_plain (M);
+
+    do {
+        n = splice (M->in, NULL, M->S[1], NULL, CHUNK, SPLICE_F_MOVE | flags);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1 && fallback (errno)) {
+        M->plain = 1;
+        return step_plain (M);
+    }
+    if (n <= 0)
+        return n;
+
+    for (i=0; i<M->nfiles; i++) {
+        m = tee (M->S[0], M->T[1], n, 0);
+        if (m > 0)
+            drain_copy (M, i, m);
+    }
+
+    M->pending = n;
+    if (forward (M, flags) == -1)
+        return -2;
+
+    return M->fwd_dead ? 0 : n;
+}
+
+
+/* copies [off, off+len) of in to out with copy_file_range(), or pread()
+ * and write() where that is refused */
+static void copy_range (Mover* M, int out, off_t off, size_t len)
+{
+    ssize_t n;
+    off_t o = off;
+
+    while (len) {
+        n = copy_file_range (M->in, &o, out, NULL, len, 0);
+        if (n == -1 && fallback (errno))
+            break;
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        len -= n;
+    }
+
+    while (len) {
+        n = pread (M->in, buffer (M), len < CHUNK ? len : CHUNK, o);
+        if (n <= 0 || write_all (out, M->buf, n) == -1)
+            return;
+        o += n;
+        len -= n;
+    }
+}
+
+
+/* regular file source: one chunk, straight from the page cache */
+static ssize_t step_file (Mover* M)
+{
+    struct stat st;
+    off_t off, o;
+    size_t len;
+    ssize_t n;
+    int i;
+
+    off = lseek (M->in, 0, SEEK_CUR);
+    if (off == -1 || fstat (M->in, &st) == -1)
+        return step_plain (M);
+    if (st.st_size <= off)
+        return 0;
+
+    len = st.st_size - off;
+    if (len > FILE_CHUNK)
+        len = FILE_CHUNK;
+
+    for (i=0; i<M->nfiles; i++)
+        copy_range (M, M->files[i], off, len);
+
+    for (o=off; M->fwd != -1 && !M->fwd_dead && o < off + (off_t) len; ) {
+        n = sendfile (M->fwd, M->in, &o, off + len - o);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && fallback (errno)) {
+            while (o < off + (off_t) len) {
+                n = pread (M->in, buffer (M), CHUNK, o);
+                if (n <= 0 || write_all (M->fwd, M->buf, n) == -1)
+                    break;
+                o += n;
+            }
+            break;
+        }
+        if (n <= 0)
+            M->fwd_dead = 1;
+    }
+
+    lseek (M->in, off + len, SEEK_SET);
+
+    return M->fwd_dead ? 0 : (ssize_t) len;
+}
+
+
+/* copies in to every destination until EOF, then frees M */
+int mover_run (Mover* M)
+{
+    struct stat st;
+    int file = fstat (M->in, &st) == 0 && S_ISREG (st.st_mode);
+    ssize_t n;
+
+    do {
+        n = file ? step_file (M) : step (M, 0);
+    } while (n > 0);
+
+    mover_free (M);
+
+    return n == 0 ? 0 : -1;
+}
+
+
+static double now ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* one sample of how full the forward pipe is; returns the bytes in
+ * it, or -1 if that cannot be told */
+static int sample (Mover* M)
+{
+    int queued;
+
+    if (M->fwd == -1 || ioctl (M->fwd, FIONREAD, &queued) == -1)
+        return -1;
+
+    M->stats->fill += queued;
+    M->stats->samples++;
+
+    return queued;
+}
+
+
+static void mover_finish (Mover* M)
+{
+    Mover** link;
+
+    if (M->stats)
+        M->stats->done = 1;
+
+    event_unwatch (M->in);
+    for (link=&movers; *link; link=&(*link)->next) {
+        if (*link == M) {
+            *link = M->next;
+            break;
+        }
+    }
+
+    mover_free (M);
+}
+
+
+static void on_readable (int fd, unsigned int events, void* arg);
+
+
+static void on_writable (int fd, unsigned int events, void* arg)
+{
+    Mover* M = arg;
+
+    if (forward (M, SPLICE_F_NONBLOCK) == -1)
+        return;
+
+    if (M->stats && M->parked) {
+        M->stats->full += now () - M->parked;
+        M->parked = 0;
+    }
+    event_unwatch (M->fwd);
+    if (M->fwd_dead)
+        mover_finish (M);
+    else
+        event_watch (M->in, EPOLLIN, on_readable, M);
+}
+
+
+static void on_readable (int fd, unsigned int events, void* arg)
+{
+    Mover* M = arg;
+    ssize_t n;
+
+    if (M->stats && M->parked) {
+        M->stats->starved += now () - M->parked;
+        M->parked = 0;
+    }
+
+    n = step (M, SPLICE_F_NONBLOCK);
+    if (M->stats) {
+        int err = errno;
+        int queued = sample (M);
+        /* running dry only counts as starving the next stage once it
+         * has drained everything it was given */
+        if ((n == -1 && err == EAGAIN && !queued) || n == -2)
+            M->parked = now ();
+        errno = err;
+    }
+
+    if (n == -2) {
+        /* stop reading until the forward pipe has room again */
+        event_unwatch (M->in);
+        if (event_watch (M->fwd, EPOLLOUT, on_writable, M) == -1) {
+            forward (M, 0);
+            event_watch (M->in, EPOLLIN, on_readable, M);
+        }
+    } else if (n == 0 || (n == -1 && errno != EAGAIN))
+        mover_finish (M);
+}
+
+
+/* hands M to the event loop; it frees itself at EOF */
+int mover_start (Mover* M, unsigned long job)
+{
+    M->job = job;
+
+    if (event_watch (M->in, EPOLLIN, on_readable, M) == -1) {
+        mover_run (M);
+        return -1;
+    }
+
+    M->next = movers;
+    movers = M;
+
+    return 0;
+}
+
+
+/* keeps S up to date from now on; S must outlive the mover or be
+ * dropped by mover_detach() */
+void mover_stats (Mover* M, PipeStats* S)
+{
+    M->stats = S;
+    if (M->fwd != -1)
+        S->capacity = fcntl (M->fwd, F_GETPIPE_SZ);
+    M->parked = now ();
+}
+
+
+/* true while a mover of the job (any mover, for 0) is still running,
+ * including one it left behind when it finished */
+int mover_busy (unsigned long job)
+{
+    Mover* M;
+
+    for (M=movers; M; M=M->next)
+        if (!job || M->job == job)
+            return 1;
+
+    return 0;
+}
+
+
+/* lets the job's movers run on after the job itself is gone; they keep
+ * its serial, which no later job is given */
+void mover_detach (unsigned long job)
+{
+    Mover* M;
+
+    for (M=movers; M; M=M->next)
+        if (M->job == job)
+            M->stats = NULL;
+}
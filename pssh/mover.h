@@ -0,0 +1,35 @@
+#ifndef _mover_h_
+#define _mover_h_
+
+/* Kernel-side copying from one descriptor to several: the tee builtin
+ * and the `|>` taps of a pipeline.
+ *
+ * A mover owns every descriptor it is given.  mover_run() copies to
+ * EOF before returning; mover_start() leaves it to the event loop,
+ * tagged with the serial of the job whose output it carries (0 for
+ * none), which outlives the job's number. */
+
+typedef struct Mover Mover;
+
+/* What a mover started from the event loop saw of the pipe it feeds,
+ * for `pipes -v`.  Times are in seconds */
+typedef struct {
+    unsigned long long bytes;    /* forwarded */
+    double full;         /* parked on a full forward pipe: the stage
+                            feeding the mover was held up writing */
+    double starved;      /* waiting on input with the forward pipe
+                            empty: the stage after was held up reading */
+    unsigned long long fill;     /* sum of sampled forward occupancy */
+    unsigned long samples;
+    int capacity;        /* of the forward pipe */
+    int done;            /* the mover reached EOF */
+} PipeStats;
+
+Mover* mover_new (int in, int fwd, int* files, int nfiles);
+int mover_run (Mover* M);
+int mover_start (Mover* M, unsigned long job);
+void mover_stats (Mover* M, PipeStats* S);
+int mover_busy (unsigned long job);
+void mover_detach (unsigned long job);
+
+#endif /* _mover_h_ */
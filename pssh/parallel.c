@@ -0,0 +1,361 @@
+/* Parallel fan-out.
+ *
+ *   parallel [-j N] command [arg...] ::: input...
+ *   parallel [-j N] command [arg...]            (inputs: lines of stdin)
+ *
+ * Runs command once per input with at most N instances in flight,
+ * starting the next one as soon as a running one has been reaped.
+ * Every "{}" in the arguments is replaced by the input; without one
+ * the input is appended as the last argument.  N defaults to the
+ * number of CPUs the shell may run on.
+ *
+ * Each instance's stdout goes to a pipe that is drained from the event
+ * loop into a buffer of its own, and the buffer is written to the
+ * builtin's output in one go when the instance is done, so output from
+ * different instances is never interleaved.  Instances are tracked as
+ * jobs, which is what lets the shell's reaper refill the pool without
+ * any polling.
+ *
+ * The instances make up one process group, as the stages of a pipeline
+ * do: in an interactive shell the first one leads a new group, which is
+ * given the terminal unless the inputs are read from it, so ^C and ^Z
+ * reach every instance at once.  Otherwise they stay in the caller's.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtin.h"
+#include "event.h"
+#include "hash.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "spawn.h"
+
+#define READ_CHUNK 65536
+
+typedef struct {
+    Job* J;              /* NULL: slot is free */
+    int fd;              /* read end of the stdout pipe, -1 once at EOF */
+    char* out;
+    size_t len;
+    size_t cap;
+} Slot;
+
+/* inputs, either the words after ::: or lines read off stdin */
+typedef struct {
+    char** words;
+    int fd;              /* -1: reading from words */
+    char* buf;
+    size_t len;
+    size_t pos;
+    int eof;
+} Input;
+
+
+static int default_jobs ()
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity (0, sizeof(set), &set) == -1)
+        return 1;
+
+    return CPU_COUNT (&set);
+}
+
+
+/* next input, or NULL when there are no more.  Lines from stdin are
+ * handed out in place and stay valid until the next call */
+static char* input_next (Input* I)
+{
+    char* nl;
+    ssize_t n;
+
+    if (I->fd == -1)
+        return *I->words ? *I->words++ : NULL;
+
+    for (;;) {
+        nl = memchr (I->buf + I->pos, '\n', I->len - I->pos);
+        if (nl || (I->eof && I->pos < I->len)) {
+            char* line = I->buf + I->pos;
+            if (!nl)
+                nl = I->buf + I->len;
+            *nl = '\0';
+            I->pos = nl - I->buf + 1;
+            return line;
+        }
+        if (I->eof)
+            return NULL;
+
+        /* keep the partial line and make room behind it */
+        memmove (I->buf, I->buf + I->pos, I->len - I->pos);
+        I->len -= I->pos;
+        I->pos = 0;
+        I->buf = realloc (I->buf, I->len + READ_CHUNK + 1);
+
+        n = read (I->fd, I->buf + I->len, READ_CHUNK);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            I->eof = 1;
+        else
+            I->len += n;
+    }
+}
+
+
+/* replaces every "{}" in word with arg */
+static char* substitute (const char* word, const char* arg)
+{
+    size_t alen = strlen (arg), n = strlen (word) + 1;
+    const char* s;
+    char *res, *d;
+
+    for (s=word; (s=strstr (s, "{}")); s+=2)
+        n += alen;
+
+    res = d = malloc (n);
+    while ((s=strstr (word, "{}"))) {
+        memcpy (d, word, s - word);
+        d += s - word;
+        memcpy (d, arg, alen);
+        d += alen;
+        word = s + 2;
+    }
+    strcpy (d, word);
+
+    return res;
+}
+
+
+static void on_output (int fd, unsigned int events, void* arg)
+{
+    Slot* S = arg;
+    ssize_t n;
+
+    for (;;) {
+        if (S->cap - S->len < READ_CHUNK) {
+            S->cap = S->cap ? S->cap * 2 : READ_CHUNK;
+            S->out = realloc (S->out, S->cap);
+        }
+        n = read (fd, S->out + S->len, S->cap - S->len);
+        if (n > 0) {
+            S->len += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && errno == EAGAIN)
+            return;
+        break;
+    }
+
+    event_unwatch (fd);
+    close (fd);
+    S->fd = -1;
+}
+
+
+/* starts cmd with one input in S, in the group *pgid (see SpawnReq), or
+ * leading a new one handed tty; returns -1 if it could not be run */
+static int launch (Slot* S, char** cmd, int ncmd, const char* path,
+                   const char* arg, int devnull, pid_t* pgid, int tty)
+{
+    void (*sav) (int sig);
+    char* argv[ncmd + 2];
+    SpawnReq R = {0};
+    int fd[2], i, k = 0, placed = 0;
+    pid_t pid;
+
+    for (i=0; i<ncmd; i++) {
+        argv[k++] = substitute (cmd[i], arg);
+        if (strstr (cmd[i], "{}"))
+            placed = 1;
+    }
+    if (!placed)
+        argv[k++] = strdup (arg);
+    argv[k] = NULL;
+
+    if (pipe2 (fd, O_CLOEXEC) == -1) {
+        fprintf (stderr, "pssh: parallel: %s\n", strerror (errno));
+        pid = -1;
+        goto out;
+    }
+
+    R.path = path;
+    R.argv = argv;
+    R.in_fd = devnull;
+    R.out_fd = fd[1];
+    R.err_fd = STDERR_FILENO;
+    R.pgid = *pgid;
+    R.tty_fd = !*pgid ? tty : -1;
+    R.cgroup_fd = -1;
+    R.pin = NULL;
+    R.pin_cpu = -1;
+    R.run = NULL;
+    R.arg = NULL;
+
+    pid = spawn (&R);
+    close (fd[1]);
+
+    if (pid == -1) {
+        fprintf (stderr, "pssh: %s: %s\n", path, strerror (errno));
+        close (fd[0]);
+        goto out;
+    }
+
+    if (*pgid != -1) {
+        if (!*pgid)
+            *pgid = pid;
+        /* also done by the child; whichever runs first wins the race */
+        setpgid (pid, *pgid);
+        if (*pgid == pid && tty != -1) {
+            sav = signal (SIGTTOU, SIG_IGN);
+            tcsetpgrp (tty, pid);
+            signal (SIGTTOU, sav);
+        }
+    }
+
+    fcntl (fd[0], F_SETFL, O_NONBLOCK);
+    S->fd = fd[0];
+    S->len = 0;
+    event_watch (fd[0], EPOLLIN, on_output, S);
+
+    /* a foreground job is left alone by the reaper once it is done */
+    S->J = job_new (argv[0], 1);
+    S->J->status = FG;
+    S->J->isFG = true;
+    job_add_proc (S->J, pid, cmd[0]);
+    if (*pgid > 0)
+        S->J->pgid = *pgid;
+
+out:
+    for (i=0; i<k; i++)
+        free (argv[i]);
+
+    return pid == -1 ? -1 : 0;
+}
+
+
+static void usage ()
+{
+    fprintf (stderr, "Usage: parallel [-j N] command [arg...] [::: input...]\n");
+}
+
+
+/* the `parallel` builtin, writing the instances' output to out; returns
+ * the number of instances that failed, capped at 101 as GNU parallel does */
+int parallel_run (char** argv, FILE* out)
+{
+    Input I = { NULL, -1, NULL, 0, 0, 0 };
+    const char* path;
+    char* arg;
+    Slot* slots;
+    int njobs = 0, ncmd, running = 0, failed = 0;
+    int devnull, i, done = 0;
+    pid_t pgid = interactive ? 0 : -1;
+    int tty = -1;
+    void (*sav) (int sig);
+
+    for (argv++; *argv && **argv == '-'; argv++) {
+        if (!strcmp (*argv, "-j") && argv[1])
+            njobs = atoi (*++argv);
+        else if (!strncmp (*argv, "-j", 2) && (*argv)[2])
+            njobs = atoi (*argv + 2);
+        else {
+            usage ();
+            return 2;
+        }
+        if (njobs <= 0) {
+            usage ();
+            return 2;
+        }
+    }
+    if (!njobs)
+        njobs = default_jobs ();
+
+    for (ncmd=0; argv[ncmd] && strcmp (argv[ncmd], ":::"); ncmd++);
+    if (!ncmd) {
+        usage ();
+        return 2;
+    }
+    if (argv[ncmd])
+        I.words = argv + ncmd + 1;
+    else
+        I.fd = STDIN_FILENO;
+
+    path = hash_lookup (argv[0]);
+    if (!path) {
+        fprintf (stderr, "pssh: command not found: %s\n", argv[0]);
+        return 127;
+    }
+
+    if (interactive && I.fd == -1 && isatty (STDIN_FILENO))
+        tty = STDIN_FILENO;
+
+    devnull = open ("/dev/null", O_RDONLY | O_CLOEXEC);
+    slots = calloc (njobs, sizeof(*slots));
+
+    while (!done || running) {
+        /* once every member has been reaped the group is gone, and the
+         * next instance has to lead a new one */
+        if (pgid > 0) {
+            for (i=0; i<njobs && (!slots[i].J || slots[i].J->status == TERM); i++);
+            if (i == njobs)
+                pgid = 0;
+        }
+
+        /* fill every free slot */
+        for (i=0; i<njobs && !done; i++) {
+            if (slots[i].J)
+                continue;
+            if (!(arg = input_next (&I))) {
+                done = 1;
+                break;
+            }
+            if (launch (&slots[i], argv, ncmd, path, arg, devnull, &pgid, tty) == -1) {
+                failed++;
+                continue;
+            }
+            running++;
+        }
+
+        if (!running)
+            break;
+
+        event_poll (-1);
+
+        /* collect instances that have exited and hit EOF on stdout */
+        for (i=0; i<njobs; i++) {
+            Slot* S = &slots[i];
+            if (!S->J || S->J->status != TERM || S->fd != -1)
+                continue;
+            fwrite (S->out, 1, S->len, out);
+            fflush (out);
+            if (job_exit_status (S->J))
+                failed++;
+            job_destroy (S->J);
+            S->J = NULL;
+            running--;
+        }
+    }
+
+    if (tty != -1) {
+        sav = signal (SIGTTOU, SIG_IGN);
+        tcsetpgrp (tty, getpgrp ());
+        signal (SIGTTOU, sav);
+    }
+
+    for (i=0; i<njobs; i++)
+        free (slots[i].out);
+    free (slots);
+    free (I.buf);
+    close (devnull);
+
+    return failed > 101 ? 101 : failed;
+}
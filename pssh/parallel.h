@@ -0,0 +1,11 @@
+#ifndef _parallel_h_
+#define _parallel_h_
+
+#include <stdio.h>
+
+/* `parallel [-j N] command [arg...] [::: input...]`: runs command once
+ * per input with at most N instances at a time, each instance's output
+ * written out whole once it finishes */
+int parallel_run (char** argv, FILE* out);
+
+#endif /* _parallel_h_ */
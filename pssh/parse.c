@@ -6,14 +6,32 @@
  *
  * Parses the following syntax:
  *
- *  ~$ command_1 [< infile] [| command_n]* [> outfile] [&]
+ *  ~$ [time] command_1 [< infile | <<< word] [2> errfile | 2>&1]
+ *        [|> file]* [| command_n [2> errfile | 2>&1] [|> file]*]*
+ *        [> outfile | >> outfile | &> outfile | &>> outfile] [&]
  *
  * and produces a correspondingly populated Parse structure on the heap
  *
+ * The line is lexed in a single pass.  Words are unquoted into a buffer
+ * and argv arrays are carved out of one arena sized from the length of
+ * the line, so a whole Parse costs one malloc() and one free().
+ *
  * Note:
  *  - Items in brackets [ ] are optional
  *  - Items in starred brackets [ ]* are optional but can be repeated
  *  - Non-bracketed items are required
+ *  - a word starting with # begins a comment
+ *  - |> file copies everything the task writes to file on the way to
+ *    the next task (or the terminal), as tee(1) would
+ *  - >> appends; 2> (2>> to append) redirects the stderr of the task
+ *    it appears in, and 2>&1 sends it wherever that task's stdout
+ *    goes, wherever in the task it is written; &> is > plus 2>&1
+ *  - <<< word feeds word, plus a newline, to the first task's stdin
+ *  - '...' and "..." quote spaces and operators; quoted and unquoted
+ *    text may be mixed within one word (a"b c" is the word: ab c)
+ *  - $VAR, ~ and * ? [...] are expanded later, after the line is parsed
+ *    (see expand.c); '...' quotes all of them, "..." all but $.  A word
+ *    with any of them left in it is marked as such (see parse.h)
  *
  * Examples of valid syntax:
  *
@@ -21,414 +39,335 @@
  *     ~$ wc -l < somefile.txt > numlines.txt
  *     ~$ ls -lh | grep 8.*K | wc -l
  *     ~$ gvim &
+ *     ~$ make |> build.log | grep error |> errors.log
+ *     ~$ make 2>&1 | grep -c warning >> counts.txt
+ *     ~$ bc <<< 2^64 &> result.txt
  **********************************************************************/
 #include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "parse.h"
 
 
 typedef struct {
-    char* cmd;
-    char** argv;
-    char* input_fn;
-    char* output_fn;
-} Unit;
-
-static char ops[] = {'>', '<', '|', '\0'};
-
-
-static void trim (char* s)
+    Parse* P;
+    char** words;        /* argv slots of every task, back to back */
+    int nwords;
+    int task_start;      /* words[] index of the current task's argv[0] */
+    char** redirect;     /* where the next word goes, if after '<', '>' or '|>' */
+    char** tees;         /* |> files of every task, back to back */
+    int ntees;
+    int tee_start;       /* tees[] index of the current task's first */
+    int outfile_task;    /* task the '>' appeared in */
+    char* errfile;       /* stderr redirections of the current task */
+    int errappend;
+    int err2out;
+} Lexer;
+
+
+/* Upper bounds for a line of len bytes: every word needs at least one
+ * byte of input, so there are at most len words (plus one NULL per
+ * task) and at most len bytes of word text.  Escapes for expansion at
+ * most double that, and a word then takes a mark and a NUL, which the
+ * byte separating it from the next makes up for.  A |> takes two
+ * bytes, so len/2 taps (plus one NULL per task) */
+static size_t arena_size (size_t len)
 {
-    size_t start, end;
-
-    if (!s)
-        return;
-
-    end = strlen (s);
-
-    for (start=0; isspace (s[start]); ++start);
-
-    if (s[start]) {
-        while (end > 0 && isspace(s[end-1]))
-            --end;
-
-        memmove(s, &s[start], end-start);
-    }
-    s[end-start] = '\0';
+    return sizeof(Parse)
+         + (len/2 + 2) * sizeof(Task)
+         + (2*len + 4) * sizeof(char*)
+         + (len + 4) * sizeof(char*)
+         + (2*len + 2)
+         + 64;
 }
 
 
-static int is_background (char* cmdline)
+static void add_word (Lexer* L, char* word, int quoted)
 {
-    size_t last;
-    int ret = 0;
-
-    trim (cmdline);
-    last = strlen (cmdline) - 1;
-
-    if ('&' == cmdline[last]) {
-        cmdline[last] = '\0';
-        ret = 1;
+    /* `time` is a keyword only as the first, unquoted word of the line */
+    if (!quoted && !L->P->ntasks && !L->nwords && !L->redirect &&
+        !strcmp (word, "time")) {
+        L->P->timed = 1;
+        return;
     }
 
-    return ret;
-}
-
-
-static int is_empty (char* cmdline)
-{
-    trim (cmdline);
-
-    if (!cmdline || !strlen(cmdline))
-        return 1;
-
-    return 0;
-}
-
-
-static int is_op (char c)
-{
-    int i;
-
-    for (i=0; ops[i]; i++)
-        if (c == ops[i])
-            return 1;
-
-    return 0;
-}
-
-
-static int has_trailing (char needle, char* haystack)
-{
-    trim (haystack);
-
-    if (haystack[0] == needle ||
-        haystack[strlen(haystack)-1] == needle) {
-        return 1;
+    if (L->redirect) {
+        *L->redirect = word;
+        L->redirect = NULL;
+        return;
     }
 
-    return 0;
-}
-
-
-static unsigned int count_char (char needle, char* haystack)
-{
-    unsigned int c = 0;
-
-    while (*haystack)
-        if (*haystack++ == needle)
-            c++;
-
-    return c;
+    L->words[L->nwords++] = word;
 }
 
 
-static unsigned int count_args (char* unit)
+/* Quoted text: bytes that would otherwise be expanded are escaped.
+ * Inside "..." a $ is left alone, and makes the word one to expand */
+static char* copy_quoted (char* out, const char* s, const char* end, int dq,
+                          int* expand)
 {
-    unsigned int n = 0;
-
-    for (; *unit; unit++) {
-        if (isspace((unsigned char)(*unit))) {
-            while (isspace((unsigned char)(*++unit)));
-            if (*unit == '\"') {
-                do {
-                    unit++;
-                } while (*unit != '\"');
-                n++;
-            } else if (*unit == '\'') {
-                do {
-                    unit++;
-                } while (*unit != '\'');
-                n++;
-            } else if (!isspace((unsigned char)(*unit))) {
-                n++;
-            }
-        }
+    const char* special = dq ? "\001\002\003*?[~" : "\001\002\003*?[~$";
+
+    for (; s<end; s++) {
+        if (strchr (special, *s))
+            *out++ = WORD_ESC;
+        else if (*s == '$')
+            *expand = 1;
+        *out++ = *s;
     }
 
-    return n;
+    return out;
 }
 
 
-static int valid_syntax (Parse* P, Unit* U, int i)
+/* Finishes the word from word to out (its NUL included): a word with
+ * something to expand gets its mark, any other loses its escapes.
+ * Returns the new end */
+static char* end_word (char* word, char* out, int expand, int quoted)
 {
-    if (!U)
-        return 0;
+    char *s, *d;
 
-    if (U->input_fn && ((i != 0) || is_empty(U->input_fn)))
-        return 0;
-
-    if (U->output_fn && ((i != P->ntasks-1) || is_empty(U->output_fn)))
-        return 0;
-
-    if (!U->cmd || !*U->cmd)
-        return 0;
-
-
-    return 1;
-}
-
-
-static char* parse_unary (char op, char* unit)
-{
-    char *start, *end, *arg;
-
-    for (start=NULL; *unit; unit++)
-        if (*unit == op) {
-           start = ++unit;
-           break;
-        }
-
-    if (!start)
-        return NULL;
-
-    for (end=start; *end; end++)
-        if (is_op(*end))
-           break;
-
-    arg = strndup (start, end - start);
-    arg[end - start] = '\0';
-    trim (arg);
+    if (expand) {
+        memmove (word + 1, word, out - word);
+        *word = quoted ? WORD_EXPAND_QUOTED : WORD_EXPAND;
+        return out + 1;
+    }
 
-    start--;
-    memset (start, ' ', end - start);
+    for (s=d=word; s<out; s++) {
+        if (*s == WORD_ESC)
+            s++;
+        *d++ = *s;
+    }
 
-    return arg;
+    return d;
 }
 
 
-static char* argtok (char* str, char** state)
+/* closes off the current task at a '|' or the end of the line */
+static void end_task (Lexer* L)
 {
-    char* ret;
-    char seek_ch;
-
-    if (!str)
-        str = *state;
-
-    if (!*str)
-        return NULL;
-
-    trim(str);
-
-    seek_ch = *str == '\"' ? '\"' :
-              *str == '\'' ? '\'' :
-              ' ';
+    Parse* P = L->P;
+    Task* T;
 
-    ret = seek_ch == ' ' ? str : ++str;
-
-    str = strchr (str, seek_ch);
-
-    if (str)
-        *str = '\0';
-
-    *state = str ? ++str : (ret + strlen(ret));
-
-    return ret;
-}
-//infile
-
-static void parse_command (Unit* U, char* unit)
-{
-    unsigned int argc, n;
-    char *str, *token, *state;
-
-    trim (unit);
-    argc = count_args (unit)+1; /* +1 for command */
-
-    U->argv = malloc ((argc+1) * sizeof(*U->argv));
-    U->argv[argc] = NULL;
-
-    for (n=0, str=unit; ; n++, str=NULL) {
-        token = argtok (str, &state);
-        if (!token)
-            break;
-
-        U->argv[n] = strdup (token);
+    if (L->redirect || L->nwords == L->task_start) {
+        P->invalid_syntax = 1;
+        return;
     }
 
-    U->cmd = U->argv[0];
+    T = &P->tasks[P->ntasks++];
+    T->argv = &L->words[L->task_start];
+    T->cmd = T->argv[0];
+    T->tee = L->ntees > L->tee_start ? &L->tees[L->tee_start] : NULL;
+    T->errfile = L->errfile;
+    T->errappend = L->errappend;
+    T->err2out = L->err2out;
+
+    L->words[L->nwords++] = NULL;
+    L->task_start = L->nwords;
+    L->tees[L->ntees++] = NULL;
+    L->tee_start = L->ntees;
+    L->errfile = NULL;
+    L->errappend = 0;
+    L->err2out = 0;
 }
 
 
-static Unit* parse_unit (char* unit)
+/* true if s holds nothing but whitespace and maybe a comment */
+static int is_blank (const char* s)
 {
-    Unit* U;
-
-    int infiles = count_char ('<', unit);
-    int outfiles = count_char ('>', unit);
-
-    if (infiles > 1 || outfiles > 1)
-        return NULL;
-
-    if (count_char ('\'', unit) % 2)
-        return NULL;
-
-    if (count_char ('\"', unit) % 2)
-        return NULL;
-
-    U = malloc (sizeof(*U));
-    U->cmd = NULL;
-    U->argv = NULL;
-
-    if (infiles)
-        U->input_fn = parse_unary ('<', unit);
-    else
-        U->input_fn = NULL;
+    while (isspace ((unsigned char)*s))
+        s++;
 
-    if (outfiles)
-        U->output_fn = parse_unary ('>', unit);
-    else
-        U->output_fn = NULL;
-
-    parse_command (U, unit);
-
-    return U;
+    return !*s || *s == '#';
 }
 
 
-static void unit_destroy (Unit** U)
+void parse_destroy (Parse** P)
 {
-    int i;
-
-    if (!*U)
+    if (!*P)
         return;
 
-    if ((*U)->input_fn)
-        free ((*U)->input_fn);
-
-    if ((*U)->output_fn)
-        free ((*U)->output_fn);
-
-    if ((*U)->argv) {
-        for (i=0; (*U)->argv[i]; i++)
-            free ((*U)->argv[i]);
-        free ((*U)->argv);
-    }
-
-    free (*U);
-    *U = NULL;
+    arena_destroy ((*P)->arena);
+    *P = NULL;
 }
 
 
-static void parse_add_unit (Parse* P, Unit* U, int i)
+Parse* parse_cmdline (char* cmdline)
 {
-    if (!valid_syntax (P, U, i)) {
-        P->invalid_syntax = 1;
-        goto out;
-    }
-
-    P->tasks[i].cmd = U->cmd;
-
-    if (U->argv) {
-        P->tasks[i].argv = U->argv;
-        U->argv = NULL;
-    }
-
-    if (U->input_fn && (i == 0)) {
-        P->infile = U->input_fn;
-        U->input_fn = NULL;
-    }
-
-    if (U->output_fn && (i == P->ntasks-1)) {
-        P->outfile = U->output_fn;
-        U->output_fn = NULL;
-    }
-
-out:
-    unit_destroy (&U);
-}
-
+    size_t len;
+    Arena* A;
+    Parse* P;
+    Lexer L;
+    char *s, *out, *word, *close;
+    char c;
+    int in_word = 0;
+    int quoted = 0;
+    int expand = 0;
+
+    if (is_blank (cmdline))
+        return NULL;
 
-static Parse* parse_new ()
-{
-    Parse* P = malloc (sizeof(*P));
+    len = strlen (cmdline);
+    A = arena_new (arena_size (len));
 
-    P->tasks = NULL;
+    P = arena_alloc (A, sizeof(*P));
+    P->tasks = arena_alloc (A, (len/2 + 2) * sizeof(*P->tasks));
     P->ntasks = 0;
     P->infile = NULL;
     P->outfile = NULL;
+    P->herestring = NULL;
+    P->append = 0;
     P->background = 0;
+    P->timed = 0;
     P->invalid_syntax = 0;
+    P->arena = A;
+
+    L.P = P;
+    L.words = arena_alloc (A, (2*len + 4) * sizeof(*L.words));
+    L.nwords = 0;
+    L.task_start = 0;
+    L.redirect = NULL;
+    L.tees = arena_alloc (A, (len + 4) * sizeof(*L.tees));
+    L.ntees = 0;
+    L.tee_start = 0;
+    L.outfile_task = -1;
+    L.errfile = NULL;
+    L.errappend = 0;
+    L.err2out = 0;
+
+    word = out = arena_alloc (A, 2*len + 2);
+
+    for (s=cmdline; !P->invalid_syntax; s++) {
+        c = *s;
+
+        /* a word starting with # comments out the rest of the line */
+        if (c == '#' && !in_word)
+            c = '\0';
+
+        if (c == '\'' || c == '\"') {
+            close = strchr (s+1, c);
+            if (!close) {
+                P->invalid_syntax = 1;
+                break;
+            }
+            out = copy_quoted (out, s+1, close, c == '\"', &expand);
+            s = close;
+            in_word = 1;
+            quoted = 1;
+            continue;
+        }
 
-    return P;
-}
-
-
-static void parse_init (Parse* P, char* cmdline)
-{
-    P->background = is_background (cmdline);
-
-    if (count_char ('&', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
-    }
-
-    if (has_trailing ('|', cmdline)) {
-        P->invalid_syntax = 1;
-        return;
-    }
-
-    P->ntasks = count_char ('|', cmdline) + 1;
-    P->tasks = malloc (P->ntasks * sizeof (*P->tasks));
-    memset (P->tasks, 0, P->ntasks * sizeof (*P->tasks));
-}
-
-
-void parse_destroy (Parse** P)
-{
-    int i, j;
-
-    if (!*P)
-        return;
+        /* 2> at the start of a word redirects stderr */
+        if (c == '2' && !in_word && s[1] == '>') {
+            if (L.redirect || L.errfile || L.err2out)
+                P->invalid_syntax = 1;
+            if (s[2] == '&' && s[3] == '1' &&
+                (!s[4] || isspace ((unsigned char)s[4]) || strchr ("<>|&", s[4]))) {
+                L.err2out = 1;
+                s += 3;
+            } else if (s[2] == '>') {
+                L.errappend = 1;
+                L.redirect = &L.errfile;
+                s += 2;
+            } else {
+                L.redirect = &L.errfile;
+                s++;
+            }
+            continue;
+        }
 
-    if ((*P)->infile)
-        free ((*P)->infile);
+        if (c && !isspace ((unsigned char)c) && !strchr ("<>|&", c)) {
+            if (c == WORD_ESC || c == WORD_EXPAND || c == WORD_EXPAND_QUOTED)
+                *out++ = WORD_ESC;
+            if (strchr ("\001\002\003$*?[~", c))
+                expand = 1;
+            *out++ = c;
+            in_word = 1;
+            continue;
+        }
 
-    if ((*P)->outfile)
-        free ((*P)->outfile);
+        if (in_word) {
+            *out++ = '\0';
+            out = end_word (word, out, expand, quoted);
+            add_word (&L, word, quoted);
+            word = out;
+            in_word = 0;
+            quoted = 0;
+            expand = 0;
+        }
 
-    if ((*P)->tasks) {
-        for (i=0; i<(*P)->ntasks; i++) {
-            if ((*P)->tasks[i].argv) {
-                for (j=0; (*P)->tasks[i].argv[j]; j++)
-                    free ((*P)->tasks[i].argv[j]);
+        if (!c)
+            break;
 
-                free ((*P)->tasks[i].argv);
+        switch (c) {
+        case '|':
+            if (s[1] == '>') {
+                if (L.redirect || L.nwords == L.task_start)
+                    P->invalid_syntax = 1;
+                L.redirect = &L.tees[L.ntees++];
+                s++;
+                break;
+            }
+            end_task (&L);
+            break;
+        case '<':
+            if (L.redirect || P->infile || P->herestring || P->ntasks)
+                P->invalid_syntax = 1;
+            if (s[1] != '<')
+                L.redirect = &P->infile;
+            else if (s[2] == '<') {
+                L.redirect = &P->herestring;
+                s += 2;
+            } else
+                P->invalid_syntax = 1;
+            break;
+        case '>':
+            if (L.redirect || P->outfile)
+                P->invalid_syntax = 1;
+            if (s[1] == '>') {
+                P->append = 1;
+                s++;
             }
+            L.redirect = &P->outfile;
+            L.outfile_task = P->ntasks;
+            break;
+        case '&':
+            if (s[1] == '>') {
+                if (L.redirect || P->outfile || L.errfile || L.err2out)
+                    P->invalid_syntax = 1;
+                if (s[2] == '>') {
+                    P->append = 1;
+                    s++;
+                }
+                L.err2out = 1;
+                L.redirect = &P->outfile;
+                L.outfile_task = P->ntasks;
+                s++;
+                break;
+            }
+            if (!is_blank (s+1))
+                P->invalid_syntax = 1;
+            P->background = 1;
+            break;
         }
-        free ((*P)->tasks);
     }
 
-    free (*P);
-    *P = NULL;
-}
-
-
-Parse* parse_cmdline (char* cmdline)
-{
-    char *str, *token, *state;
-    int i;
-    Unit* U;
-    Parse* P;
-
-    if (is_empty (cmdline))
+    /* nothing but a comment */
+    if (!P->invalid_syntax && !L.nwords && !L.redirect && !P->background &&
+        !P->timed) {
+        arena_destroy (A);
         return NULL;
+    }
 
-    P = parse_new ();
-    parse_init (P, cmdline);
-
-    for (i=0, str=cmdline; !P->invalid_syntax; i++, str=NULL) {
-        token = strtok_r (str, "|", &state);
-        if (!token)
-            break;
-
-        U = parse_unit (token);
+    /* a lone `time` is a pipeline of no tasks, timed at nothing */
+    if (!P->invalid_syntax && !(P->timed && !L.nwords && !L.redirect && !P->background))
+        end_task (&L);
 
-        parse_add_unit (P, U, i);
-    }
+    if (P->outfile && L.outfile_task != P->ntasks-1)
+        P->invalid_syntax = 1;
 
     return P;
 }
@@ -444,8 +383,11 @@ void parse_debug (Parse* P)
     if (P->infile)
         fprintf (stderr, "infile: %s\n", P->infile);
 
+    if (P->herestring)
+        fprintf (stderr, "herestring: %s\n", P->herestring);
+
     if (P->outfile)
-        fprintf (stderr, "outfile: %s\n", P->outfile);
+        fprintf (stderr, "outfile: %s%s\n", P->outfile, P->append ? " (append)" : "");
 
     fprintf (stderr, "ntasks: %i\n", P->ntasks);
 
@@ -456,6 +398,16 @@ void parse_debug (Parse* P)
         if (P->tasks[i].argv)
             for (j=0; P->tasks[i].argv[j]; j++)
                 fprintf (stderr, "    + arg[%i]: [%s]\n", j, P->tasks[i].argv[j]);
+
+        if (P->tasks[i].tee)
+            for (j=0; P->tasks[i].tee[j]; j++)
+                fprintf (stderr, "    + tee[%i]: [%s]\n", j, P->tasks[i].tee[j]);
+
+        if (P->tasks[i].errfile)
+            fprintf (stderr, "  - errfile: %s%s\n", P->tasks[i].errfile,
+                     P->tasks[i].errappend ? " (append)" : "");
+        else if (P->tasks[i].err2out)
+            fprintf (stderr, "  - stderr: to stdout\n");
     }
 
     fprintf (stderr, "==================================[ DEBUG: PARSE ]==\n");
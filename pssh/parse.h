@@ -3,9 +3,21 @@
 
 #include <limits.h>
 
+/* A word with something in it to expand (see expand.c) starts with
+ * WORD_EXPAND, or WORD_EXPAND_QUOTED if part of it was quoted; within
+ * it, the byte after a WORD_ESC is literal.  Any other word is plain
+ * text, already unquoted. */
+#define WORD_ESC            '\001'
+#define WORD_EXPAND         '\002'
+#define WORD_EXPAND_QUOTED  '\003'
+
 typedef struct {
     char* cmd;
     char** argv;   /* NULL terminated array of strings */
+    char** tee;    /* files tapped with |>, NULL terminated, or NULL */
+    char* errfile; /* filename of '2>' or '2>>', or NULL */
+    int errappend; /* '2>>' rather than '2>'? */
+    int err2out;   /* '2>&1' (or '&>'): stderr goes where stdout does */
 } Task;
 
 typedef struct {
@@ -14,9 +26,14 @@ typedef struct {
 
     char* infile;        /* filename of 'infile'  */
     char* outfile;       /* filename of 'outfile' */
+    char* herestring;    /* word after '<<<', fed to stdin with a newline */
+    int append;          /* '>>' rather than '>'? */
 
     int background;      /* run process in background? */
+    int timed;           /* prefixed with the `time` keyword? */
     int invalid_syntax;  /* parse failed */
+
+    struct Arena* arena; /* owns this Parse and everything in it */
 } Parse;
 
 
@@ -0,0 +1,421 @@
+/* Pathname expansion.
+ *
+ * A pattern is split at its slashes into components.  A component
+ * without a wildcard is a name to open (or, last, to check for); any
+ * other is compiled into segments, the runs of ?, [...] and literal
+ * bytes between its *s:
+ *
+ *     access.log.*.gz     head "access.log."  tail ".gz"
+ *     *err*[0-9]*         head ""  mids "err", "[0-9]"  tail ""
+ *
+ * A name matches when it starts with the head and ends with the tail
+ * (two memcmp()s for literal ones, which rejects nearly every entry of
+ * a big directory) and the mids are found in order in between; taking
+ * the leftmost place for each mid is never wrong.  A mid starting with
+ * a literal byte is looked for with memchr(), which glibc vectorizes.
+ *
+ * Directories are read with getdents64() into a large buffer, and the
+ * entry type it reports decides whether a name can be descended into:
+ * nothing is stat()ed except symlinks and the odd file system that does
+ * not fill in d_type, for components that must be directories.  The
+ * matches are sorted once, at the end, in byte order.
+ *
+ * Like bash, a wildcard never matches a leading '.', and . and .. are
+ * never matched at all.  ? and [...] match one byte.
+ **********************************************************************/
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+#include "pattern.h"
+
+/* bytes of directory entries read per getdents64() */
+#define DENTS_BUF (256 << 10)
+
+enum { T_LIT, T_ANY, T_CLASS };
+
+typedef struct {
+    unsigned char op;
+    unsigned char c;             /* T_LIT */
+    const unsigned char* set;    /* T_CLASS: 256-bit map */
+} Tok;
+
+typedef struct {
+    Tok* tok;
+    size_t n;            /* tokens, and so bytes matched */
+    const char* lit;     /* the bytes, if every token is a T_LIT */
+} Seg;
+
+typedef struct {
+    char* name;          /* without a wildcard: the name itself */
+    Seg* seg;            /* head, mids, tail */
+    int nseg;            /* 1: no * at all */
+    int dot;             /* begins with a literal '.' */
+    int dir;             /* followed by a '/': directories only */
+} Comp;
+
+struct Pattern {
+    int absolute;
+    Comp* comp;
+    int ncomp;
+};
+
+typedef struct {
+    char path[PATH_MAX];
+    PathList* L;
+} Walk;
+
+
+/* reads a [...] class at s into set; returns the byte after it, or NULL
+ * if s does not start a class (it is then a literal '[') */
+static const char* parse_class (const char* s, unsigned char* set)
+{
+    int neg = 0, lo, hi, c;
+
+    memset (set, 0, 32);
+    s++;
+    if (*s == '!' || *s == '^') {
+        neg = 1;
+        s++;
+    }
+
+    for (c=0; ; c++) {
+        if (!*s)
+            return NULL;
+        if (*s == ']' && c)
+            break;
+        if (*s == WORD_ESC && s[1])
+            s++;
+        lo = hi = (unsigned char)*s++;
+        if (*s == '-' && s[1] && s[1] != ']') {
+            s++;
+            if (*s == WORD_ESC && s[1])
+                s++;
+            hi = (unsigned char)*s++;
+        }
+        for (; lo <= hi; lo++)
+            set[lo >> 3] |= 1 << (lo & 7);
+    }
+
+    if (neg)
+        for (c=0; c<32; c++)
+            set[c] = ~set[c];
+
+    return s + 1;
+}
+
+
+/* compiles the component at s, len bytes long */
+static void compile_comp (Comp* C, const char* s, size_t len, Arena* A)
+{
+    const char* end = s + len;
+    Tok* tok = arena_alloc (A, (len + 1) * sizeof(*tok));
+    unsigned char set[32], *copy;
+    const char* next;
+    size_t n = 0, start = 0, i;
+    int wild = 0, k;
+    char* lit;
+
+    C->seg = arena_alloc (A, (len + 1) * sizeof(*C->seg));
+    C->nseg = 0;
+
+    while (s < end) {
+        if (*s == '*') {
+            wild = 1;
+            while (s < end && *s == '*')
+                s++;
+            C->seg[C->nseg].tok = tok + start;
+            C->seg[C->nseg++].n = n - start;
+            start = n;
+            continue;
+        }
+        if (*s == '?') {
+            wild = 1;
+            tok[n++].op = T_ANY;
+            s++;
+            continue;
+        }
+        if (*s == '[' && (next = parse_class (s, set)) && next <= end) {
+            wild = 1;
+            copy = arena_alloc (A, 32);
+            memcpy (copy, set, 32);
+            tok[n].op = T_CLASS;
+            tok[n++].set = copy;
+            s = next;
+            continue;
+        }
+        if (*s == WORD_ESC && s + 1 < end)
+            s++;
+        tok[n].op = T_LIT;
+        tok[n++].c = *s++;
+    }
+    C->seg[C->nseg].tok = tok + start;
+    C->seg[C->nseg++].n = n - start;
+
+    C->dot = C->seg[0].n && tok[0].op == T_LIT && tok[0].c == '.';
+
+    for (k=0; k<C->nseg; k++) {
+        Seg* G = &C->seg[k];
+        G->lit = NULL;
+        for (i=0; i<G->n && G->tok[i].op == T_LIT; i++);
+        if (i < G->n)
+            continue;
+        G->lit = lit = arena_alloc (A, G->n + 1);
+        for (i=0; i<G->n; i++)
+            lit[i] = G->tok[i].c;
+        lit[i] = '\0';
+    }
+
+    C->name = wild ? NULL : (char*)C->seg[0].lit;
+}
+
+
+/* compiles text; returns NULL if it has no wildcard in it */
+Pattern* pattern_compile (const char* text, Arena* A)
+{
+    Pattern* G = arena_alloc (A, sizeof(*G));
+    const char *s = text, *slash;
+    int wild = 0, n = 1;
+
+    for (s=text; *s; s++)
+        if (*s == '/')
+            n++;
+    G->comp = arena_alloc (A, n * sizeof(*G->comp));
+    G->ncomp = 0;
+    G->absolute = *text == '/';
+
+    for (s=text; *s; s=slash) {
+        while (*s == '/')
+            s++;
+        if (!*s)
+            break;
+        slash = strchrnul (s, '/');
+        Comp* C = &G->comp[G->ncomp++];
+        compile_comp (C, s, slash - s, A);
+        C->dir = *slash == '/';
+        if (!C->name)
+            wild = 1;
+    }
+
+    return wild ? G : NULL;
+}
+
+
+static int seg_at (const Seg* G, const char* s)
+{
+    const Tok* t;
+    unsigned char c;
+    size_t i;
+
+    if (G->lit)
+        return !memcmp (s, G->lit, G->n);
+
+    for (i=0; i<G->n; i++) {
+        t = &G->tok[i];
+        c = s[i];
+        if (t->op == T_LIT ? c != t->c :
+            t->op == T_CLASS && !(t->set[c >> 3] & (1 << (c & 7))))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/* the leftmost place in [s, end) G matches at, or NULL */
+static const char* seg_find (const Seg* G, const char* s, const char* end)
+{
+    const char* last;
+
+    if ((size_t)(end - s) < G->n)
+        return NULL;
+    last = end - G->n;
+
+    if (G->n && G->tok[0].op == T_LIT) {
+        while ((s = memchr (s, G->tok[0].c, last - s + 1))) {
+            if (seg_at (G, s))
+                return s;
+            if (s++ == last)
+                break;
+        }
+        return NULL;
+    }
+
+    for (; s <= last; s++)
+        if (seg_at (G, s))
+            return s;
+
+    return NULL;
+}
+
+
+static int match (const Comp* C, const char* name, size_t len)
+{
+    const Seg* head = &C->seg[0];
+    const Seg* tail = &C->seg[C->nseg - 1];
+    const char *s, *end;
+    int k;
+
+    if (*name == '.' && !C->dot)
+        return 0;
+
+    if (C->nseg == 1)
+        return len == head->n && seg_at (head, name);
+
+    if (len < head->n + tail->n || !seg_at (head, name) ||
+        !seg_at (tail, name + len - tail->n))
+        return 0;
+
+    s = name + head->n;
+    end = name + len - tail->n;
+    for (k=1; k<C->nseg-1; k++) {
+        if (!(s = seg_find (&C->seg[k], s, end)))
+            return 0;
+        s += C->seg[k].n;
+    }
+
+    return 1;
+}
+
+
+void pathlist_add (PathList* L, char* s)
+{
+    if (L->n == L->cap) {
+        L->cap = L->cap ? 2 * L->cap : 16;
+        L->v = realloc (L->v, L->cap * sizeof(*L->v));
+    }
+    L->v[L->n++] = s;
+}
+
+
+static void add (Walk* W, size_t len)
+{
+    char* s = arena_alloc (W->L->A, len + 1);
+
+    memcpy (s, W->path, len);
+    s[len] = '\0';
+    pathlist_add (W->L, s);
+}
+
+
+/* appends name (and a slash if dir) to the path at len; 0 if too long */
+static size_t append (Walk* W, size_t len, const char* name, size_t n, int dir)
+{
+    if (len + n + 2 > sizeof(W->path))
+        return 0;
+
+    memcpy (W->path + len, name, n);
+    len += n;
+    if (dir)
+        W->path[len++] = '/';
+
+    return len;
+}
+
+
+static int is_dir (int dirfd, const char* name, unsigned char type)
+{
+    struct stat st;
+
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_LNK && type != DT_UNKNOWN)
+        return 0;
+
+    return fstatat (dirfd, name, &st, 0) == 0 && S_ISDIR (st.st_mode);
+}
+
+
+static void walk (const Pattern* G, Walk* W, int dirfd, size_t len, int i);
+
+
+/* carries on into the directory name of dirfd for component i */
+static void descend (const Pattern* G, Walk* W, int dirfd, const char* name,
+                     size_t len, int i)
+{
+    int fd = openat (dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd == -1)
+        return;
+    walk (G, W, fd, len, i);
+    close (fd);
+}
+
+
+static void walk (const Pattern* G, Walk* W, int dirfd, size_t len, int i)
+{
+    const Comp* C = &G->comp[i];
+    int last = i == G->ncomp - 1;
+    struct dirent64* d;
+    struct stat st;
+    char* buf;
+    long got, off;
+    size_t n, at;
+
+    if (C->name) {
+        if (!(at = append (W, len, C->name, strlen (C->name), C->dir)))
+            return;
+        if (!last)
+            descend (G, W, dirfd, C->name, at, i + 1);
+        else if (fstatat (dirfd, C->name, &st, C->dir ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+                 (!C->dir || S_ISDIR (st.st_mode)))
+            add (W, at);
+        return;
+    }
+
+    if (!(buf = malloc (DENTS_BUF)))
+        return;
+
+    while ((got = getdents64 (dirfd, buf, DENTS_BUF)) > 0) {
+        for (off=0; off<got; off+=d->d_reclen) {
+            d = (struct dirent64*)(buf + off);
+            if (d->d_name[0] == '.' &&
+                (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+                continue;
+            n = strlen (d->d_name);
+            if (!match (C, d->d_name, n))
+                continue;
+            if ((!last || C->dir) && !is_dir (dirfd, d->d_name, d->d_type))
+                continue;
+            if (!(at = append (W, len, d->d_name, n, C->dir)))
+                continue;
+            if (last)
+                add (W, at);
+            else
+                descend (G, W, dirfd, d->d_name, at, i + 1);
+        }
+    }
+
+    free (buf);
+}
+
+
+static int by_bytes (const void* a, const void* b)
+{
+    return strcmp (*(char* const*)a, *(char* const*)b);
+}
+
+
+/* adds the paths G matches to L, sorted; returns how many there were */
+size_t pattern_glob (const Pattern* G, PathList* L)
+{
+    Walk W;
+    size_t start = L->n;
+    int fd;
+
+    W.L = L;
+    W.path[0] = '/';
+    if ((fd = open (G->absolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return 0;
+    walk (G, &W, fd, G->absolute, 0);
+    close (fd);
+
+    qsort (L->v + start, L->n - start, sizeof(*L->v), by_bytes);
+
+    return L->n - start;
+}
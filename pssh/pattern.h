@@ -0,0 +1,29 @@
+#ifndef _pattern_h_
+#define _pattern_h_
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/* Pathname expansion: *, ? and [...] patterns matched against the file
+ * system.
+ *
+ * pattern_compile() turns the text of a pattern, in the parser's quoted
+ * form (a byte after WORD_ESC is literal, see parse.h), into a Pattern
+ * allocated from an arena; it can then be matched any number of times.
+ * pattern_glob() appends the paths it matches, sorted, to a PathList
+ * whose strings come from the list's arena. */
+
+typedef struct Pattern Pattern;
+
+typedef struct {
+    char** v;            /* malloc()ed; the strings are in A */
+    size_t n, cap;
+    Arena* A;
+} PathList;
+
+Pattern* pattern_compile (const char* text, Arena* A);
+size_t pattern_glob (const Pattern* G, PathList* L);
+void pathlist_add (PathList* L, char* s);
+
+#endif /* _pattern_h_ */
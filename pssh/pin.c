@@ -0,0 +1,360 @@
+/* CPU and memory placement of jobs.
+ *
+ *   pin [-c cpulist] [-N node] [-a] [-b | -i] [-n nice] [-o class[:level]]
+ *       command [| command]*
+ *
+ *   -c   run on the CPUs of cpulist (such as 0-3,8)
+ *   -N   prefer memory from NUMA node; also runs on its CPUs if no -c
+ *   -a   place successive stages on adjacent cores, one stage per core
+ *   -b   SCHED_BATCH
+ *   -i   SCHED_IDLE
+ *   -n   nice value
+ *   -o   I/O priority: rt, be or idle, with a level of 0-7 for rt and be
+ *
+ * Adjacent placement orders the allowed CPUs by package, then by last
+ * level cache, then by hardware thread, then by core; stage k of the
+ * pipeline gets the k-th of them, so a producer and its consumer share
+ * an L3 (and never an SMT sibling while there are free cores) and the
+ * pipe between them never crosses a socket.
+ *
+ * Everything is applied in the child between fork and exec.
+ **********************************************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+#include <linux/mempolicy.h>
+
+#include "pin.h"
+
+#define CPU_DIR  "/sys/devices/system/cpu"
+#define NODE_DIR "/sys/devices/system/node"
+
+typedef struct {
+    int cpu;
+    int package;
+    int llc;
+    int thread;          /* rank among the core's hardware threads */
+    int core;
+} Topo;
+
+
+/* parses a list such as 0-3,8,10-11 into set; returns -1 if malformed */
+static int parse_cpulist (const char* s, cpu_set_t* set)
+{
+    char* end;
+    long lo, hi;
+
+    CPU_ZERO (set);
+    while (*s && *s != '\n') {
+        lo = hi = strtol (s, &end, 10);
+        if (end == s || lo < 0)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol (s, &end, 10);
+            if (end == s || hi < lo)
+                return -1;
+        }
+        if (hi >= PIN_MAX_CPUS)
+            return -1;
+        for (; lo <= hi; lo++)
+            CPU_SET (lo, set);
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s && *s != '\n')
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/* reads the first integer of a sysfs file, or returns dflt */
+static int read_int (const char* path, int dflt)
+{
+    FILE* f = fopen (path, "re");
+    int n;
+
+    if (!f)
+        return dflt;
+    if (fscanf (f, "%d", &n) != 1)
+        n = dflt;
+    fclose (f);
+
+    return n;
+}
+
+
+/* the id of cpu's highest level cache */
+static int llc_id (int cpu)
+{
+    char path[128];
+    int i, level, best = -1, id = -1;
+
+    for (i=0; ; i++) {
+        snprintf (path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/level", cpu, i);
+        if ((level = read_int (path, -1)) == -1)
+            break;
+        if (level > best) {
+            best = level;
+            snprintf (path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/id", cpu, i);
+            id = read_int (path, -1);
+        }
+    }
+
+    return id;
+}
+
+
+/* cpu's rank among the threads of its core: 0 for the first sibling */
+static int thread_rank (int cpu)
+{
+    char path[128], buf[256];
+    cpu_set_t siblings;
+    FILE* f;
+    int i, rank = 0;
+
+    snprintf (path, sizeof(path), CPU_DIR "/cpu%d/topology/thread_siblings_list", cpu);
+    if (!(f = fopen (path, "re")))
+        return 0;
+    if (!fgets (buf, sizeof(buf), f) || parse_cpulist (buf, &siblings) == -1)
+        CPU_ZERO (&siblings);
+    fclose (f);
+
+    for (i=0; i<cpu; i++)
+        if (CPU_ISSET (i, &siblings))
+            rank++;
+
+    return rank;
+}
+
+
+static int topo_cmp (const void* a, const void* b)
+{
+    const Topo *x = a, *y = b;
+
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->llc != y->llc)
+        return x->llc - y->llc;
+    if (x->thread != y->thread)
+        return x->thread - y->thread;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+
+/* fills order[] with the CPUs of set, adjacent ones sharing a cache */
+static int topo_order (const cpu_set_t* set, int* order, Topo* T)
+{
+    char path[128];
+    int cpu, n = 0;
+
+    for (cpu=0; cpu<PIN_MAX_CPUS; cpu++) {
+        if (!CPU_ISSET (cpu, set))
+            continue;
+        T[n].cpu = cpu;
+        snprintf (path, sizeof(path), CPU_DIR "/cpu%d/topology/physical_package_id", cpu);
+        T[n].package = read_int (path, 0);
+        snprintf (path, sizeof(path), CPU_DIR "/cpu%d/topology/core_id", cpu);
+        T[n].core = read_int (path, cpu);
+        T[n].llc = llc_id (cpu);
+        T[n].thread = thread_rank (cpu);
+        n++;
+    }
+
+    qsort (T, n, sizeof(*T), topo_cmp);
+    for (cpu=0; cpu<n; cpu++)
+        order[cpu] = T[cpu].cpu;
+
+    return n;
+}
+
+
+static int parse_ioprio (const char* s)
+{
+    int class, level = 4;
+    const char* colon = strchr (s, ':');
+    size_t len = colon ? (size_t)(colon - s) : strlen (s);
+
+    if (len == 2 && !strncmp (s, "rt", 2))
+        class = IOPRIO_CLASS_RT;
+    else if (len == 2 && !strncmp (s, "be", 2))
+        class = IOPRIO_CLASS_BE;
+    else if (len == 4 && !strncmp (s, "idle", 4))
+        class = IOPRIO_CLASS_IDLE;
+    else
+        return -1;
+
+    if (colon) {
+        if (class == IOPRIO_CLASS_IDLE || !isdigit ((unsigned char)colon[1]) ||
+            colon[2] || colon[1] > '7')
+            return -1;
+        level = colon[1] - '0';
+    }
+    if (class == IOPRIO_CLASS_IDLE)
+        level = 0;
+
+    return IOPRIO_PRIO_VALUE (class, level);
+}
+
+
+/* fills P from the options of a `pin` argv; returns the index of the
+ * command word (which may be the terminating NULL) or -1 if an option
+ * is malformed */
+int pin_parse (char** argv, Pin* P)
+{
+    char path[128], buf[1024], *end;
+    cpu_set_t node_cpus;
+    FILE* f;
+    int i;
+
+    memset (P, 0, sizeof(*P));
+    P->policy = -1;
+    P->ioprio = -1;
+    P->node = -1;
+
+    for (i=1; argv[i] && argv[i][0] == '-'; i++) {
+        if (!strcmp (argv[i], "--")) {
+            i++;
+            break;
+        }
+        if (argv[i][2])
+            return -1;
+
+        switch (argv[i][1]) {
+        case 'a':
+            P->adjacent = 1;
+            continue;
+        case 'b':
+            P->policy = SCHED_BATCH;
+            continue;
+        case 'i':
+            P->policy = SCHED_IDLE;
+            continue;
+        }
+
+        if (!argv[i+1])
+            return -1;
+        switch (argv[i][1]) {
+        case 'c':
+            if (parse_cpulist (argv[++i], &P->cpus) == -1 || !CPU_COUNT (&P->cpus))
+                return -1;
+            P->has_cpus = 1;
+            break;
+        case 'N':
+            P->node = strtol (argv[++i], &end, 10);
+            if (*end || P->node < 0 || P->node >= 64)
+                return -1;
+            break;
+        case 'n':
+            P->nice = strtol (argv[++i], &end, 10);
+            if (*end)
+                return -1;
+            P->has_nice = 1;
+            break;
+        case 'o':
+            if ((P->ioprio = parse_ioprio (argv[++i])) == -1)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (P->node != -1 && !P->has_cpus) {
+        snprintf (path, sizeof(path), NODE_DIR "/node%d/cpulist", P->node);
+        if (!(f = fopen (path, "re")))
+            return -1;
+        if (fgets (buf, sizeof(buf), f) && parse_cpulist (buf, &node_cpus) == 0 &&
+            CPU_COUNT (&node_cpus)) {
+            P->cpus = node_cpus;
+            P->has_cpus = 1;
+        }
+        fclose (f);
+    }
+
+    if (P->adjacent) {
+        Topo* T = malloc (PIN_MAX_CPUS * sizeof(*T));
+        if (!P->has_cpus)
+            sched_getaffinity (0, sizeof(P->cpus), &P->cpus);
+        P->norder = topo_order (&P->cpus, P->order, T);
+        free (T);
+    }
+
+    return i;
+}
+
+
+/* the CPU stage runs on alone, or -1 for the whole of P->cpus */
+int pin_stage_cpu (const Pin* P, int stage)
+{
+    if (!P->adjacent || !P->norder)
+        return -1;
+
+    return P->order[stage % P->norder];
+}
+
+
+/* Called in the child before exec.  Failures are not fatal: the job
+ * still runs, only less well placed */
+void pin_apply (const Pin* P, int cpu)
+{
+    struct sched_param sp = { 0 };
+    unsigned long mask;
+    cpu_set_t one;
+
+    if (cpu != -1) {
+        CPU_ZERO (&one);
+        CPU_SET (cpu, &one);
+        sched_setaffinity (0, sizeof(one), &one);
+    } else if (P->has_cpus)
+        sched_setaffinity (0, sizeof(P->cpus), &P->cpus);
+
+    if (P->policy != -1)
+        sched_setscheduler (0, P->policy, &sp);
+
+    if (P->has_nice)
+        setpriority (PRIO_PROCESS, 0, P->nice);
+
+    if (P->ioprio != -1)
+        syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, P->ioprio);
+
+    if (P->node != -1) {
+        mask = 1UL << P->node;
+        /* the kernel takes maxnode as one past the last bit it reads */
+        syscall (SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1);
+    }
+}
+
+
+/* `pin` on its own: the order -a places stages in */
+void pin_print_order (FILE* out)
+{
+    Topo* T = malloc (PIN_MAX_CPUS * sizeof(*T));
+    int order[PIN_MAX_CPUS];
+    cpu_set_t set;
+    int i, n;
+
+    sched_getaffinity (0, sizeof(set), &set);
+    n = topo_order (&set, order, T);
+
+    for (i=0; i<n; i++) {
+        if (!i || T[i].package != T[i-1].package || T[i].llc != T[i-1].llc)
+            fprintf (out, "%spackage %d llc %d:", i ? "\n" : "",
+                     T[i].package, T[i].llc);
+        fprintf (out, " %d", T[i].cpu);
+    }
+    if (n)
+        fprintf (out, "\n");
+
+    free (T);
+}
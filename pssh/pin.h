@@ -0,0 +1,33 @@
+#ifndef _pin_h_
+#define _pin_h_
+
+#include <sched.h>
+#include <stdio.h>
+
+/* Where and how a job's processes run, for the `pin` builtin.
+ *
+ * pin_parse() reads the options (and, for adjacent placement, the cache
+ * topology) in the shell; pin_apply() only makes system calls, so it is
+ * safe between vfork() and exec(). */
+
+#define PIN_MAX_CPUS 1024
+
+typedef struct {
+    cpu_set_t cpus;      /* allowed CPUs */
+    int has_cpus;
+    int adjacent;        /* stage k gets order[k % norder] alone */
+    int order[PIN_MAX_CPUS];
+    int norder;
+    int policy;          /* SCHED_BATCH or SCHED_IDLE, or -1 */
+    int nice;
+    int has_nice;
+    int ioprio;          /* ioprio_set() value, or -1 */
+    int node;            /* preferred NUMA node, or -1 */
+} Pin;
+
+int pin_parse (char** argv, Pin* P);
+int pin_stage_cpu (const Pin* P, int stage);
+void pin_apply (const Pin* P, int cpu);
+void pin_print_order (FILE* out);
+
+#endif /* _pin_h_ */
@@ -0,0 +1,123 @@
+/* Pipe sizing.
+ *
+ *   pipes [-s size[KM]] [-d | -D] [-v] command [| command]*
+ *
+ * A pipe holds 64 KiB by default, so a fast producer and its consumer
+ * take turns every 64 KiB, each switch a pair of context switches.  A
+ * bigger pipe (F_SETPIPE_SZ, rounded up by the kernel to a power of two
+ * pages and capped here at /proc/sys/fs/pipe-max-size) lets each side
+ * run for longer at a stretch.
+ *
+ * -d makes the pipes O_DIRECT "packet" pipes: every write() is one
+ * packet and a read() returns at most one, so record boundaries
+ * survive; a reader whose buffer is smaller than a packet loses the
+ * rest of it.  -D turns packet mode off again.
+ *
+ * -v instruments every pipe of the job: the shell relays each one
+ * through a mover of its own (see mover.c), which counts the bytes,
+ * samples how full the pipe downstream of it is with FIONREAD, and
+ * times how long it waits on either side.  `jobs -v` shows the numbers
+ * live and they are printed when the job is done.  A pipe that stays
+ * full means the stage reading it is the bottleneck; one that stays
+ * empty, the stage writing it.
+ *
+ * `set -o pipesize=N`, `set -o pipedirect` and `set -o pipestats` (or
+ * +o) change the defaults every job starts from.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipes.h"
+
+PipeOpts pipe_defaults = { 0, 0, 0 };
+
+
+/* /proc/sys/fs/pipe-max-size, read once */
+int pipes_max ()
+{
+    static int max;
+    FILE* f;
+
+    if (!max) {
+        max = 1 << 20;
+        if ((f = fopen ("/proc/sys/fs/pipe-max-size", "re"))) {
+            if (fscanf (f, "%d", &max) != 1 || max <= 0)
+                max = 1 << 20;
+            fclose (f);
+        }
+    }
+
+    return max;
+}
+
+
+/* parses a capacity such as 256K, capped at pipes_max(); 0 asks for
+ * the kernel's default.  Returns -1 if s is not a size */
+int pipes_size (const char* s)
+{
+    char* end;
+    long n = strtol (s, &end, 10);
+
+    if (end == s || n < 0)
+        return -1;
+
+    if (*end == 'K' || *end == 'k') {
+        n <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        n <<= 20;
+        end++;
+    }
+    if (*end)
+        return -1;
+
+    return n > pipes_max () ? pipes_max () : n;
+}
+
+
+/* fills O, starting from the defaults, from the options of a `pipes`
+ * argv; returns the index of the command word (which may be the
+ * terminating NULL) or -1 if an option is malformed */
+int pipes_parse (char** argv, PipeOpts* O)
+{
+    int i;
+
+    *O = pipe_defaults;
+
+    for (i=1; argv[i] && argv[i][0] == '-'; i++) {
+        if (!strcmp (argv[i], "--"))
+            return i + 1;
+        if (!strcmp (argv[i], "-d"))
+            O->direct = 1;
+        else if (!strcmp (argv[i], "-D"))
+            O->direct = 0;
+        else if (!strcmp (argv[i], "-v"))
+            O->stats = 1;
+        else if (!strcmp (argv[i], "-s") && argv[i+1]) {
+            if ((O->size = pipes_size (argv[++i])) == -1)
+                return -1;
+        } else
+            return -1;
+    }
+
+    return i;
+}
+
+
+/* pipe2() with O_CLOEXEC, and O's mode and capacity.  A capacity the
+ * kernel refuses (over the user's pipe-user-pages-soft) is not an
+ * error: the pipe keeps its default size */
+int pipes_open (int fd[2], const PipeOpts* O)
+{
+    if (pipe2 (fd, O_CLOEXEC | (O->direct ? O_DIRECT : 0)) == -1)
+        return -1;
+
+    if (O->size)
+        fcntl (fd[1], F_SETPIPE_SZ, O->size);
+
+    return 0;
+}
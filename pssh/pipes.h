@@ -0,0 +1,23 @@
+#ifndef _pipes_h_
+#define _pipes_h_
+
+/* How the pipes between pipeline stages are made.
+ *
+ * The shell-wide defaults come from `set -o pipesize=N`, `set -o
+ * pipedirect` and `set -o pipestats`; a `pipes` prefix overrides them
+ * for one job. */
+
+typedef struct {
+    int size;            /* F_SETPIPE_SZ capacity in bytes, 0: kernel default */
+    int direct;          /* O_DIRECT packet mode */
+    int stats;           /* relay each pipe through the shell, measuring it */
+} PipeOpts;
+
+extern PipeOpts pipe_defaults;
+
+int pipes_size (const char* s);
+int pipes_max (void);
+int pipes_parse (char** argv, PipeOpts* O);
+int pipes_open (int fd[2], const PipeOpts* O);
+
+#endif /* _pipes_h_ */
@@ -0,0 +1,323 @@
+/* Execution plans and the cache that keeps them.
+ *
+ * Scripts and automation run the same lines over and over.  Each time,
+ * a line would be parsed, its prefixes read, every command looked up
+ * (one stat() of its directory per command, see hash.c) and the job
+ * name pieced together.  A Plan holds the outcome of all of that, and
+ * the last PLAN_MAX plans are kept in an LRU keyed by the line, so a
+ * line seen before goes straight to spawning its job.
+ *
+ * Like the command hash, a plan is only as good as the $PATH and the
+ * working directory it was compiled in (a relative command, or $PATH
+ * entry, means something else after a `cd`).  Changing $PATH, `cd`,
+ * `hash -r`/`-p` and `set -o pipe...` all make every plan stale; a
+ * stale plan is compiled again the next time its line comes up.  As
+ * with `hash`, a command installed earlier on $PATH is not noticed
+ * until then.
+ *
+ * A line with $, ~ or a wildcard in it comes out differently each time
+ * it runs.  Its plan keeps the parse and the expansions compiled from it
+ * (see expand.c), and each run gets a plan of its own, expanded and
+ * resolved then, from plan_instance().
+ *
+ * `hash -c` shows the plans and the hit and miss counts.
+ **********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "expand.h"
+#include "hash.h"
+#include "plan.h"
+#include "trace.h"
+
+#define PLAN_MAX     64
+#define PLAN_BUCKETS 128     /* power of two */
+
+static Plan* buckets[PLAN_BUCKETS];
+static Plan *head, *tail;    /* LRU order */
+static unsigned int nplans;
+static unsigned int gen = 1;
+static char* planned_path;   /* $PATH the plans were compiled against */
+static unsigned long hits, misses;
+
+
+static unsigned int plan_hash (const char* s)
+{
+    unsigned int h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    return h & (PLAN_BUCKETS - 1);
+}
+
+
+static void plan_destroy (Plan* L)
+{
+    int t;
+
+    if (L->paths)
+        for (t=0; t<L->P->ntasks; t++)
+            free (L->paths[t]);
+    free (L->paths);
+    free (L->name);
+    free (L->pin);
+    free (L->line);
+    expand_destroy (L->X);
+    parse_destroy (&L->P);
+    free (L);
+}
+
+
+static void unlink_lru (Plan* L)
+{
+    if (L->prev)
+        L->prev->next = L->next;
+    else
+        head = L->next;
+    if (L->next)
+        L->next->prev = L->prev;
+    else
+        tail = L->prev;
+}
+
+
+static void push_lru (Plan* L)
+{
+    L->prev = NULL;
+    L->next = head;
+    if (head)
+        head->prev = L;
+    head = L;
+    if (!tail)
+        tail = L;
+}
+
+
+static void plan_remove (Plan* L)
+{
+    Plan** link;
+
+    for (link=&buckets[plan_hash (L->line)]; *link != L; link=&(*link)->chain);
+    *link = L->chain;
+    unlink_lru (L);
+    nplans--;
+    plan_destroy (L);
+}
+
+
+/* every plan compiled so far is stale */
+void plan_invalidate ()
+{
+    gen++;
+}
+
+
+/* the cached plan for line, or NULL */
+Plan* plan_lookup (const char* line)
+{
+    const char* PATH = getenv ("PATH");
+    Plan* L;
+
+    if (!PATH)
+        PATH = "";
+    if (!planned_path || strcmp (PATH, planned_path)) {
+        free (planned_path);
+        planned_path = strdup (PATH);
+        gen++;
+    }
+
+    for (L=buckets[plan_hash (line)]; L; L=L->chain)
+        if (!strcmp (L->line, line))
+            break;
+    if (!L)
+        return NULL;
+
+    if (L->gen != gen) {
+        plan_remove (L);
+        return NULL;
+    }
+
+    L->hits++;
+    hits++;
+    if (L != head) {
+        unlink_lru (L);
+        push_lru (L);
+    }
+
+    return L;
+}
+
+
+/* "cmd arg | cmd arg", the name jobs know the line by */
+static char* job_name (Parse* P)
+{
+    size_t len = 1;
+    char* name;
+    int t, e;
+
+    for (t=0; t<P->ntasks; t++)
+        for (e=0; P->tasks[t].argv[e]; e++)
+            len += strlen (P->tasks[t].argv[e]) + 3;
+
+    name = malloc (len);
+    *name = '\0';
+    for (t=0; t<P->ntasks; t++) {
+        if (t)
+            strcat (name, "| ");
+        for (e=0; P->tasks[t].argv[e]; e++) {
+            strcat (name, P->tasks[t].argv[e]);
+            strcat (name, " ");
+        }
+    }
+
+    return name;
+}
+
+
+/* reads the prefixes of L's parse, resolves its commands and names it;
+ * 127 if one of them cannot be found */
+static int plan_prepare (Plan* L)
+{
+    Parse* P = L->P;
+    Pin* pin = malloc (sizeof(*pin));
+    char** argv;
+    int piped = 0;
+    int k, t;
+    const char* path;
+    uint64_t t0;
+
+    hash_new_epoch ();
+
+    L->po = pipe_defaults;
+
+    /* `limit`, `pin` and `pipes` with a command apply to the whole job: their
+     * options come off the first task, which then runs as usual */
+    for (;;) {
+        argv = P->tasks[0].argv;
+        if (!L->limited && !strcmp (argv[0], "limit") &&
+            (k = limit_parse (argv, &L->lim)) > 0 && argv[k])
+            L->limited = 1;
+        else if (!L->pin && !strcmp (argv[0], "pin") &&
+                 (k = pin_parse (argv, pin)) > 0 && argv[k])
+            L->pin = pin;
+        else if (!piped && !strcmp (argv[0], "pipes") &&
+                 (k = pipes_parse (argv, &L->po)) > 0 && argv[k])
+            piped = 1;
+        else
+            break;
+        P->tasks[0].argv += k;
+        P->tasks[0].cmd = P->tasks[0].argv[0];
+    }
+    if (!L->pin)
+        free (pin);
+
+    if (P->ntasks == 1 && !L->limited && !L->pin)
+        L->B = builtin_lookup (P->tasks[0].cmd);
+
+    L->paths = calloc (P->ntasks, sizeof(*L->paths));
+    for (t=0; !L->B && t<P->ntasks; t++) {
+        if (is_builtin (P->tasks[t].cmd))
+            continue;
+        t0 = trace_now ();
+        path = hash_lookup (P->tasks[t].cmd);
+        trace_span ("lookup", t0, P->tasks[t].cmd);
+        if (!path) {
+            printf ("pssh: command not found: %s\n", P->tasks[t].cmd);
+            return 127;
+        }
+        L->paths[t] = strdup (path);
+    }
+
+    L->name = job_name (P);
+
+    return 0;
+}
+
+
+/* Compiles P, the parse of line, into a plan, which takes P over and
+ * goes in the cache.  Returns NULL, with *status set to 127, if one of
+ * its commands cannot be found.
+ *
+ * A line with words to expand cannot be resolved once and for all: its
+ * plan only holds the parse and its compiled expansions, and is made
+ * ready to run by plan_instance(). */
+Plan* plan_compile (const char* line, Parse* P, int* status)
+{
+    Plan* L = calloc (1, sizeof(*L));
+    unsigned int h;
+
+    misses++;
+
+    L->P = P;
+    if (!(L->X = expand_compile (P)) && (*status = plan_prepare (L))) {
+        plan_destroy (L);
+        return NULL;
+    }
+
+    L->line = strdup (line);
+    L->gen = gen;
+
+    h = plan_hash (line);
+    L->chain = buckets[h];
+    buckets[h] = L;
+    push_lru (L);
+    if (++nplans > PLAN_MAX)
+        plan_remove (tail);
+
+    return L;
+}
+
+
+/* The plan to run for L: L itself, or for a line with words to expand,
+ * a plan of its own for this run, to be given back to plan_release().
+ * Returns NULL, with *status set, if the expansion or a command lookup
+ * fails. */
+Plan* plan_instance (Plan* L, int* status)
+{
+    uint64_t t0 = trace_now ();
+    Plan* R;
+    Parse* P;
+
+    if (!L->X)
+        return L;
+
+    P = expand_run (L->X, L->P);
+    trace_span ("expand", t0, L->line);
+    if (!P) {
+        *status = 1;
+        return NULL;
+    }
+
+    R = calloc (1, sizeof(*R));
+    R->P = P;
+    if ((*status = plan_prepare (R))) {
+        plan_destroy (R);
+        return NULL;
+    }
+
+    return R;
+}
+
+
+void plan_release (Plan* R)
+{
+    if (!R->line)
+        plan_destroy (R);
+}
+
+
+/* `hash -c`: the plans, most recently used first, and how the cache
+ * is doing */
+void plan_list (FILE* out)
+{
+    Plan* L;
+
+    fprintf (out, "plans: %u cached, %lu hits, %lu misses\n", nplans, hits, misses);
+    for (L=head; L; L=L->next)
+        fprintf (out, "%4lu\t%s%s%s\n", L->hits, L->line,
+                 L->X ? "  (expands)" : "", L->gen != gen ? "  (stale)" : "");
+}
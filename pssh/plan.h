@@ -0,0 +1,46 @@
+#ifndef _plan_h_
+#define _plan_h_
+
+#include <stdio.h>
+
+#include "builtin.h"
+#include "cgroup.h"
+#include "expand.h"
+#include "parse.h"
+#include "pin.h"
+#include "pipes.h"
+
+/* A command line compiled for execute_tasks(): parsed, its `limit`,
+ * `pin` and `pipes` prefixes taken off and read, every command resolved
+ * and the job named.
+ *
+ * Plans are cached by the text of their line and owned by the cache; a
+ * plan is good until the next plan_compile().  plan_instance() gives the
+ * plan to run, which for a line with words to expand is a new one each
+ * time, owned by the caller until plan_release(). */
+
+typedef struct Plan {
+    char* line;
+    Parse* P;
+    Expansion* X;        /* its words to expand, or NULL */
+    const Builtin* B;    /* a lone builtin, run in the shell, or NULL */
+    char** paths;        /* per task: what it execs, NULL for a builtin */
+    char* name;          /* of the job */
+    Limits lim;          /* from `limit`, if limited */
+    int limited;
+    Pin* pin;            /* from `pin`, or NULL */
+    PipeOpts po;         /* from `pipes` and the defaults */
+    unsigned long hits;
+    unsigned int gen;    /* plan_invalidate()s it has seen */
+    struct Plan *prev, *next;   /* most recently used first */
+    struct Plan* chain;         /* in its bucket */
+} Plan;
+
+Plan* plan_lookup (const char* line);
+Plan* plan_compile (const char* line, Parse* P, int* status);
+Plan* plan_instance (Plan* L, int* status);
+void plan_release (Plan* R);
+void plan_invalidate (void);
+void plan_list (FILE* out);
+
+#endif /* _plan_h_ */
@@ -0,0 +1,322 @@
+/* The interactive prompt.
+ *
+ *   ~/src/pssh (master*) &2 ?1$
+ *
+ * is a pipeline of segments: the working directory, the git branch
+ * (with a * once a tracked file has changed), the number of jobs when
+ * there are any and the last exit status when it is not 0.  Each
+ * segment is rendered from its own slice of the shell's state and only
+ * again when that slice has changed; the prompt is joined up again only
+ * when a segment was.  The working directory is only read on startup
+ * and by `cd`, which tells us through prompt_chdir().
+ *
+ * The git segment can be slow (see vcs.c), so a worker thread computes
+ * it, anew after every command line.  prompt_update() waits for it for
+ * at most PROMPT_BUDGET_MS; if it is not done by then the prompt goes
+ * up without it (or with the branch alone) and is redrawn when the rest
+ * arrives, the worker waking the event loop through an eventfd.  A new
+ * request makes the worker drop the one it is working on.
+ **********************************************************************/
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "event.h"
+#include "prompt.h"
+#include "vcs.h"
+
+/* how long a prompt waits on the git segment */
+#define PROMPT_BUDGET_MS 30
+
+typedef struct {
+    char cwd[PATH_MAX];
+    int in_repo;
+    VcsStatus vcs;
+    int status;
+    unsigned int jobs;
+} Inputs;
+
+typedef struct {
+    size_t off, len;     /* the slice of Inputs it is rendered from */
+    void (*render) (const Inputs* I, char* buf, size_t size);
+    char text[PATH_MAX];
+} Segment;
+
+#define SLICE(from, to) \
+    offsetof (Inputs, from), offsetof (Inputs, to) + sizeof(((Inputs*)0)->to) - offsetof (Inputs, from)
+
+static void seg_cwd (const Inputs* I, char* buf, size_t size);
+static void seg_vcs (const Inputs* I, char* buf, size_t size);
+static void seg_jobs (const Inputs* I, char* buf, size_t size);
+static void seg_status (const Inputs* I, char* buf, size_t size);
+
+static Segment segments[] = {
+    { SLICE (cwd, cwd),       seg_cwd },
+    { SLICE (in_repo, vcs),   seg_vcs },
+    { SLICE (jobs, jobs),     seg_jobs },
+    { SLICE (status, status), seg_status },
+};
+
+#define NSEGMENTS (sizeof(segments) / sizeof(segments[0]))
+
+static Inputs cur;       /* the shell's state */
+static Inputs shown;     /* what the segments were last rendered from */
+static int rendered;
+static char text[NSEGMENTS * PATH_MAX + 3];
+
+/* the worker.  want counts requests; have is the last one with a
+ * result (perhaps the branch alone), got the last one finished */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done;
+static unsigned long want, have, got, waited;
+static char want_dir[PATH_MAX];
+static VcsStatus result;
+static int result_repo;
+static int efd = -1;
+static pid_t owner;
+static void (*redraw) (void);
+
+
+static void seg_cwd (const Inputs* I, char* buf, size_t size)
+{
+    const char* home = getenv ("HOME");
+    size_t len = home ? strlen (home) : 0;
+
+    if (len > 1 && !strncmp (I->cwd, home, len) &&
+        (I->cwd[len] == '/' || !I->cwd[len]))
+        snprintf (buf, size, "~%s", I->cwd + len);
+    else
+        snprintf (buf, size, "%s", I->cwd);
+}
+
+
+static void seg_vcs (const Inputs* I, char* buf, size_t size)
+{
+    if (!I->in_repo)
+        *buf = '\0';
+    else
+        snprintf (buf, size, " (%s%s)", I->vcs.branch, I->vcs.dirty == 1 ? "*" : "");
+}
+
+
+static void seg_jobs (const Inputs* I, char* buf, size_t size)
+{
+    if (!I->jobs)
+        *buf = '\0';
+    else
+        snprintf (buf, size, " &%u", I->jobs);
+}
+
+
+static void seg_status (const Inputs* I, char* buf, size_t size)
+{
+    if (!I->status)
+        *buf = '\0';
+    else
+        snprintf (buf, size, " ?%d", I->status);
+}
+
+
+/* cancel() for vcs_dirty(): a newer request came in */
+static int superseded (void* arg)
+{
+    return __atomic_load_n (&want, __ATOMIC_RELAXED) != *(unsigned long*)arg;
+}
+
+
+/* hands the result of request gen over, if it is still wanted */
+static void publish (unsigned long gen, const VcsStatus* S, int repo, int final)
+{
+    uint64_t one = 1;
+    int fresh;
+
+    pthread_mutex_lock (&lock);
+    if ((fresh = gen == want)) {
+        result = *S;
+        result_repo = repo;
+        have = gen;
+        if (final)
+            got = gen;
+        pthread_cond_broadcast (&done);
+    }
+    pthread_mutex_unlock (&lock);
+
+    /* fails only when the counter is full, which wakes the loop anyway */
+    if (fresh && write (efd, &one, sizeof(one)) == -1)
+        return;
+}
+
+
+static void* worker (void* arg)
+{
+    char dir[PATH_MAX];
+    unsigned long gen;
+    VcsStatus S;
+    int repo;
+
+    for (;;) {
+        pthread_mutex_lock (&lock);
+        while (got == want)
+            pthread_cond_wait (&work, &lock);
+        gen = want;
+        strcpy (dir, want_dir);
+        pthread_mutex_unlock (&lock);
+
+        memset (&S, 0, sizeof(S));
+        repo = vcs_branch (dir, &S) == 0;
+        if (repo) {
+            publish (gen, &S, repo, 0);
+            S.dirty = vcs_dirty (dir, superseded, &gen);
+        }
+        publish (gen, &S, repo, 1);
+    }
+
+    return NULL;
+}
+
+
+static void on_result (int fd, unsigned int events, void* arg)
+{
+    uint64_t n;
+
+    if (read (fd, &n, sizeof(n)) == -1)
+        return;
+    if (redraw)
+        redraw ();
+}
+
+
+/* starts the worker; redraw is called from the event loop whenever
+ * a git result arrives after its prompt went up */
+void prompt_init (void (*fn)(void))
+{
+    pthread_condattr_t attr;
+    pthread_t tid;
+    sigset_t all, old;
+
+    redraw = fn;
+    owner = getpid ();
+
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&done, &attr);
+    pthread_condattr_destroy (&attr);
+
+    efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd != -1 && event_watch (efd, EPOLLIN, on_result, NULL) == -1) {
+        close (efd);
+        efd = -1;
+    }
+
+    /* signals are for the main thread */
+    sigfillset (&all);
+    pthread_sigmask (SIG_SETMASK, &all, &old);
+    if (efd != -1 && pthread_create (&tid, NULL, worker, NULL) == 0)
+        pthread_detach (tid);
+    else if (efd != -1) {
+        event_unwatch (efd);
+        close (efd);
+        efd = -1;
+    }
+    pthread_sigmask (SIG_SETMASK, &old, NULL);
+
+    prompt_chdir ();
+}
+
+
+/* asks the worker for the git segment of the working directory again */
+void prompt_vcs_refresh ()
+{
+    /* a forked pipeline stage has no worker */
+    if (efd == -1 || getpid () != owner)
+        return;
+
+    pthread_mutex_lock (&lock);
+    strcpy (want_dir, cur.cwd);
+    __atomic_store_n (&want, want + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal (&work);
+    pthread_mutex_unlock (&lock);
+}
+
+
+/* the working directory changed */
+void prompt_chdir ()
+{
+    if (!getcwd (cur.cwd, sizeof(cur.cwd)))
+        strcpy (cur.cwd, "?");
+
+    /* the old directory's branch is no good here */
+    cur.in_repo = 0;
+    memset (&cur.vcs, 0, sizeof(cur.vcs));
+    prompt_vcs_refresh ();
+}
+
+
+/* brings the prompt up to date; returns 1 if its text changed */
+int prompt_update (int status, unsigned int jobs)
+{
+    char buf[PATH_MAX];
+    struct timespec deadline;
+    int changed = 0;
+    size_t k, len;
+
+    cur.status = status;
+    cur.jobs = jobs;
+
+    if (efd != -1) {
+        pthread_mutex_lock (&lock);
+        if (got != want && waited != want) {
+            clock_gettime (CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += PROMPT_BUDGET_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (got != want &&
+                   pthread_cond_timedwait (&done, &lock, &deadline) != ETIMEDOUT);
+            waited = want;
+        }
+        if (have == want) {
+            cur.in_repo = result_repo;
+            cur.vcs = result;
+        }
+        pthread_mutex_unlock (&lock);
+    }
+
+    for (k=0; k<NSEGMENTS; k++) {
+        Segment* G = &segments[k];
+        if (rendered && !memcmp ((char*)&cur + G->off, (char*)&shown + G->off, G->len))
+            continue;
+        G->render (&cur, buf, sizeof(buf));
+        if (!rendered || strcmp (buf, G->text)) {
+            strcpy (G->text, buf);
+            changed = 1;
+        }
+    }
+    shown = cur;
+    rendered = 1;
+    if (!changed)
+        return 0;
+
+    for (k=0, len=0; k<NSEGMENTS; k++)
+        len += snprintf (text + len, sizeof(text) - len, "%s", segments[k].text);
+    snprintf (text + len, sizeof(text) - len, "$ ");
+
+    return 1;
+}
+
+
+const char* prompt_text ()
+{
+    return text;
+}
@@ -0,0 +1,18 @@
+#ifndef _prompt_h_
+#define _prompt_h_
+
+/* The interactive prompt.
+ *
+ * prompt_update() brings the prompt up to date with the shell's state
+ * and says whether its text changed; prompt_text() is that text.  The
+ * git segment is computed on a thread: when a result lands after the
+ * prompt was shown, the event loop calls the redraw function given to
+ * prompt_init(). */
+
+void prompt_init (void (*redraw)(void));
+void prompt_chdir (void);
+void prompt_vcs_refresh (void);
+int prompt_update (int status, unsigned int jobs);
+const char* prompt_text (void);
+
+#endif /* _prompt_h_ */
@@ -2,23 +2,42 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <readline/readline.h>
 
 #include "builtin.h"
+#include "cgroup.h"
+#include "complete.h"
+#include "event.h"
+#include "hash.h"
+#include "history.h"
+#include "jobs.h"
+#include "mover.h"
 #include "parse.h"
+#include "pin.h"
+#include "pipes.h"
+#include "plan.h"
+#include "prompt.h"
+#include "spawn.h"
+#include "trace.h"
 
 /*******************************************
  * Set to 1 to view the command line parse *
  *******************************************/
 #define DEBUG_PARSE 0
 
-Job *jobArr[100];
-int w;
-int last = 0;
-int increment = 0;
-int isFG = 1;
+/* bytes read at a time from a script */
+#define SCRIPT_BLOCK 65536
+
 
 
 
@@ -33,341 +52,969 @@ void print_banner ()
 }
 
 
-/* **returns** a string used to build the prompt
- * (DO NOT JUST printf() IN HERE!)
- *
- * Note:
- *   If you modify this function to return a string on the heap,
- *   be sure to free() it later when appropirate!  */
-char *build_prompt ()
-{
-    char cd[256];
-    if (getcwd(cd, 256) == NULL){
-        fprintf(stderr,"getcwd() error\n");
-        return EXIT_FAILURE;
+/* false when running a script or -c string, or in a forked pipeline
+ * stage: no prompt, no job control */
+int interactive = 1;
+
+/* set while readline owns the terminal; job notices printed from the
+ * event loop then have to clear and redraw the half-typed line */
+static int at_prompt = 0;
+static int noticed = 0;
+
+static void job_notice(const char *fmt, ...){
+    va_list ap;
+    if(!interactive)
+        return;
+    if(at_prompt && !noticed)
+        rl_clear_visible_line();
+    if(at_prompt && *fmt == '\n')
+        fmt++;
+    noticed = 1;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
+
+/* Runs from the event loop whenever SIGCHLD is pending on the signalfd.
+ * Collects every child that changed state and updates its job.
+ * Finished foreground jobs are left for wait_foreground() to collect. */
+void reap_children(){
+    pid_t chld;
+    int status;
+    struct rusage ru;
+    Job *J;
+    Process *proc;
+
+    noticed = 0;
+    trace_instant("SIGCHLD", NULL);
+    while( (chld = wait4(-1, &status, WNOHANG | WCONTINUED | WUNTRACED, &ru)) > 0) {
+        J = job_find_pid(chld, &proc);
+        if(!J) continue;
+        job_update(J, proc, status, &ru);
+        if (WIFCONTINUED(status)) {
+            if(chld == J->pgid)
+                job_notice("[%d] %c continued   %s\n", J->id, job_mark(J), J->name);
+        } 
+        else if (WIFSTOPPED(status)) {
+            if(chld == J->pgid)
+                job_notice("\n[%d] %c stopped   %s\n", J->id, job_mark(J), J->name);
+        } 
+        else if(J->status == TERM && !J->isFG){
+            job_notice("\n[%d] %c done   %s\n", J->id, job_mark(J), J->name);
+            if(J->timed)
+                job_print_usage(J, stderr, true);
+            else if(J->edges)
+                job_print_pipes(J, stderr);
+            mover_detach(J->serial);
+            job_destroy(J);
+        }
+    }
+    if(at_prompt && noticed){
+        if(prompt_update(last_status, job_count()))
+            rl_set_prompt(prompt_text());
+        rl_on_new_line();
+        rl_redisplay();
     }
-    char *pthway;
-    pthway = malloc(256);
-    strcpy(pthway,cd);
-    strcat(pthway,"$ ");
-    return pthway;
 }
 
+/* Dispatches events until J is no longer running in the foreground,
+ * then takes the terminal back.  A finished J is destroyed.
+ * Returns the job's exit status (128+SIGTSTP if it was stopped). */
+static int wait_foreground(Job *J){
+    void (*sav)(int sig);
+    int status = 128 + SIGTSTP;
+    /* a |> tap may still hold output after its task has exited */
+    while(J->isFG && (J->status != TERM || mover_busy(J->serial)))
+        event_poll(-1);
+    if(interactive && isatty(STDIN_FILENO)){
+        uint64_t t0 = trace_now();
+        sav = signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+        signal(SIGTTOU, sav);
+        trace_span("tcsetpgrp", t0, "shell");
+    }
+    if(J->status == TERM){
+        status = job_exit_status(J);
+        if(J->timed)
+            job_print_usage(J, stderr, true);
+        else if(J->edges)
+            job_print_pipes(J, stderr);
+        job_destroy(J);
+    }
+    return status;
+}
 
-/* return true if command is found, either:
- *   - a valid fully qualified path was supplied to an existing file
- *   - the executable file was found in the system's PATH
- * false is returned otherwise */
-static int command_found (const char* cmd)
-{
-    char* dir;
-    char* tmp;
-    char* PATH;
-    char* state;
-    char probe[PATH_MAX];
+void sighandler(int sig){
+    printf("SIGTTOU\n");
+    exit(EXIT_FAILURE);  
+}
 
-    int ret = 0;
+/* opens the pipeline's '<' file or '<<<' string, returning STDIN_FILENO
+ * if there is neither and -1 if it cannot be opened */
+int open_infile(Parse *P){
+    int f;
+    if(P->herestring){
+        /* a here-string is a file in memory, so any length fits */
+        size_t len = strlen(P->herestring);
+        f = memfd_create("herestring", MFD_CLOEXEC);
+        if(f == -1 || write(f, P->herestring, len) != (ssize_t)len ||
+           write(f, "\n", 1) != 1 || lseek(f, 0, SEEK_SET) == -1){
+            fprintf(stderr, "pssh: <<<: %s\n", strerror(errno));
+            if(f != -1) close(f);
+            return -1;
+        }
+        return f;
+    }
+    if(P->infile == NULL)
+        return STDIN_FILENO;
+    f = open(P->infile, O_RDONLY | O_CLOEXEC);
+    if(f == -1)
+        fprintf(stderr, "pssh: %s: %s\n", P->infile, strerror(errno));
+    return f;
+}
 
-    if (access (cmd, X_OK) == 0)
-        return 1;
+/* opens the pipeline's '>' or '>>' file, returning STDOUT_FILENO if
+ * there is none and -1 if it cannot be opened */
+int open_outfile(Parse *P){
+    int d;
+    if(P->outfile == NULL)
+        return STDOUT_FILENO;
+    d = open(P->outfile, O_WRONLY | O_CREAT | O_CLOEXEC |
+             (P->append ? O_APPEND : O_TRUNC), 0666);
+    if(d == -1)
+        fprintf(stderr, "pssh: %s: %s\n", P->outfile, strerror(errno));
+    return d;
+}
 
-    PATH = strdup (getenv("PATH"));
+/* opens a task's '2>' or '2>>' file, returning STDERR_FILENO if there
+ * is none (STDOUT_FILENO for 2>&1) and -1 if it cannot be opened */
+int open_errfile(Task *T){
+    int d;
+    if(T->err2out)
+        return STDOUT_FILENO;
+    if(T->errfile == NULL)
+        return STDERR_FILENO;
+    d = open(T->errfile, O_WRONLY | O_CREAT | O_CLOEXEC |
+             (T->errappend ? O_APPEND : O_TRUNC), 0666);
+    if(d == -1)
+        fprintf(stderr, "pssh: %s: %s\n", T->errfile, strerror(errno));
+    return d;
+}
 
-    for (tmp=PATH; ; tmp=NULL) {
-        dir = strtok_r (tmp, ":", &state);
-        if (!dir)
-            break;
+/* moves fd onto std, first parking the shell's own std in saved[std] */
+static int redirect_std(int fd, int std, int saved[3]){
+    saved[std] = fcntl(std, F_DUPFD_CLOEXEC, 10);
+    if(saved[std] == -1 || dup2(fd, std) == -1){
+        fprintf(stderr, "pssh: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/* applies the line's redirections to the shell itself, for a builtin.
+ * saved[] receives the displaced descriptors (-1 where none was) for
+ * restore_std(); returns -1 if a file could not be opened */
+static int redirect_builtin(Parse *P, int saved[3]){
+    int in, out, err;
+    saved[0] = saved[1] = saved[2] = -1;
+    in = open_infile(P);
+    if(in == -1)
+        return -1;
+    out = open_outfile(P);
+    if(out == -1){
+        if(in != STDIN_FILENO) close(in);
+        return -1;
+    }
+    fflush(stdout);
+    if(in != STDIN_FILENO && redirect_std(in, STDIN_FILENO, saved) == -1){
+        if(out != STDOUT_FILENO) close(out);
+        return -1;
+    }
+    if(out != STDOUT_FILENO && redirect_std(out, STDOUT_FILENO, saved) == -1)
+        return -1;
+    err = open_errfile(&P->tasks[0]);
+    if(err == -1)
+        return -1;
+    if(err == STDOUT_FILENO){
+        /* 2>&1: a copy, since redirect_std() closes what it moves */
+        fflush(stderr);
+        err = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        if(err == -1)
+            return -1;
+    }
+    if(err != STDERR_FILENO && redirect_std(err, STDERR_FILENO, saved) == -1)
+        return -1;
+    return 0;
+}
 
-        strncpy (probe, dir, PATH_MAX-1);
-        strncat (probe, "/", PATH_MAX-1);
-        strncat (probe, cmd, PATH_MAX-1);
+static void restore_std(int saved[3]){
+    fflush(stdout);
+    fflush(stderr);
+    for(int std = 0; std < 3; std++){
+        if(saved[std] == -1)
+            continue;
+        dup2(saved[std], std);
+        close(saved[std]);
+    }
+}
 
-        if (access (probe, X_OK) == 0) {
-            ret = 1;
-            break;
+/* closes everything open_taps() opened for the first ntasks tasks */
+static void close_taps(int tap[][2], int **tapfd, int *ntapfd, int ntasks){
+    for(int k = 0; k < ntasks; k++){
+        for(int i = 0; i < ntapfd[k]; i++)
+            close(tapfd[k][i]);
+        free(tapfd[k]);
+        if(tap[k][0] != -1){
+            close(tap[k][0]);
+            close(tap[k][1]);
         }
     }
-
-    free (PATH);
-    return ret;
 }
 
-void handler(int sig){
-    pid_t chld;
-    int status;
-    void (*sav)(int sig);
-    int check = 1;
-    int breakCheck = 0;
-    pid_t fg;
-    switch (sig) {
-    case SIGCHLD:
-        while( (chld = waitpid(-1, &status, WNOHANG | WCONTINUED | WUNTRACED)) > 0) {
-            if (chld == tcgetpgrp(STDIN_FILENO)) isFG = 0;
-            sav = signal(SIGTTOU, SIG_IGN);
-            tcsetpgrp(STDOUT_FILENO, getpgrp());
-            signal(SIGTTOU, sav);
-            breakCheck = 0;
-            for(increment = 0; increment < 10; increment++){
-                if(jobArr[increment] == NULL) continue;
-                for(int q = 0; q < jobArr[increment]->npids; q++){
-                    if(jobArr[increment]->pids[q] == chld){
-                        breakCheck = 1; 
-                        break;
-                    }
-                }
-                if(breakCheck) break;
-            }
-            if (WIFCONTINUED(status)) {
-                jobArr[increment]->status = BG;
-                if(jobArr[increment]->isFG) jobArr[increment]->status = FG;
-                printf("[%d] + continued   %s\n",increment, jobArr[increment]->name);
-            } 
-            else if (WIFSTOPPED(status)) {
-                if(chld == jobArr[increment]->pgid)
-                    printf("\n[%d] + stopped   %s\n",increment, jobArr[increment]->name);
-                last = 0;
-                jobArr[increment]->status = STOPPED;
-                jobArr[increment]->isFG = false;
-            } 
-            else {
-                last++;
-                if(last == jobArr[increment]->npids){
-                    char cd[256];
-                    getcwd(cd,256);
-                    if(!jobArr[increment]->isFG) {
-                        printf("\n[%d] + done   %s\n",increment, jobArr[increment]->name);
-                    }
-                    free(jobArr[increment]->name);
-                    free(jobArr[increment]->pids);
-                    free(jobArr[increment]);
-                    jobArr[increment] = NULL;
-                    last = 0;
-                }
+/* opens the |> files of every task and a pipe for each tapped task to
+ * write into; tap[k] is {-1, -1} for a task without any.  An
+ * instrumented pipeline (po->stats) gets a tap, with no files, on
+ * every pipe between two tasks */
+static int open_taps(Parse *P, int tap[][2], int **tapfd, int *ntapfd,
+                     const PipeOpts *po){
+    for(int k = 0; k < P->ntasks; k++){
+        char **tee = P->tasks[k].tee;
+        int nt = 0;
+        tap[k][0] = tap[k][1] = -1;
+        tapfd[k] = NULL;
+        ntapfd[k] = 0;
+        if(!tee && !(po->stats && k < P->ntasks - 1))
+            continue;
+        while(tee && tee[nt]) nt++;
+        tapfd[k] = malloc(nt * sizeof(int));
+        for(int i = 0; i < nt; i++){
+            tapfd[k][i] = open(tee[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if(tapfd[k][i] == -1){
+                fprintf(stderr, "pssh: %s: %s\n", tee[i], strerror(errno));
+                ntapfd[k] = i;
+                close_taps(tap, tapfd, ntapfd, k + 1);
+                return -1;
             }
         }
-        break;
-    default:
-        break;
+        ntapfd[k] = nt;
+        if(pipes_open(tap[k], po) == -1){
+            fprintf(stderr, "failed to create pipe\n");
+            close_taps(tap, tapfd, ntapfd, k + 1);
+            return -1;
+        }
     }
+    return 0;
 }
 
-void sighandler(int sig){
-    printf("SIGTTOU\n");
-    exit(EXIT_FAILURE);  
+/* hands each launched task's tap to a mover that copies it to the
+ * task's files and on to wherever the task's output was going */
+static void start_taps(Parse *P, int tap[][2], int **tapfd, int *ntapfd,
+                       int fd[][2], int out, int launched, Job *J){
+    for(int k = 0; k < P->ntasks; k++){
+        if(tap[k][0] == -1)
+            continue;
+        close(tap[k][1]);
+        if(k >= launched){
+            close(tap[k][0]);
+            for(int i = 0; i < ntapfd[k]; i++)
+                close(tapfd[k][i]);
+            free(tapfd[k]);
+            continue;
+        }
+        int to = k == P->ntasks - 1 ? out : fd[k][1];
+        Mover *M = mover_new(tap[k][0], fcntl(to, F_DUPFD_CLOEXEC, 0),
+                             tapfd[k], ntapfd[k]);
+        if(J && (unsigned)k < J->nedges)
+            mover_stats(M, &J->edges[k].stats);
+        mover_start(M, J ? J->serial : 0);
+    }
 }
 
-void ifile(Parse *P){
-    if(!(P->infile == NULL)){
-        int f = open(P->infile, O_RDONLY);
-        if(dup2(f, STDIN_FILENO) == -1) {
-            fprintf(stderr, "dup2() failed!\n");
-            exit(EXIT_FAILURE);
-        }
+/* A builtin stage of a pipeline.  BUILTIN_PURE ones run inside the
+ * shell: the builtin itself runs at launch, into memory, and a thread
+ * writes that out to the stage's pipe, so neither the shell's state nor
+ * its main loop is touched from another thread and a slow reader never
+ * stalls the shell.  A BUILTIN_FORKABLE one runs in a fork()ed child;
+ * any other is refused. */
+typedef struct {
+    const Builtin *B;
+    Task T;
+    pthread_t tid;
+    int fd;
+    char *buf;
+    size_t len;
+    int status;
+    int refs;       /* the thread and the pipeline: last one out frees */
+} Stage;
+
+static int write_all(int fd, const char *p, size_t len){
+    ssize_t n;
+    while(len){
+        n = write(fd, p, len);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1)
+            return -1;
+        p += n;
+        len -= n;
     }
+    return 0;
 }
 
-void ofile(Parse *P){
-    if(!(P->outfile == NULL)){
-        int d = creat(P->outfile, 0666);
-        if (dup2(d, STDOUT_FILENO) == -1) {
-            fprintf(stderr, "dup2() failed!\n");
-            exit(EXIT_FAILURE);
-        }
+static void stage_put(Stage *S){
+    if(__atomic_sub_fetch(&S->refs, 1, __ATOMIC_ACQ_REL) == 0){
+        free(S->buf);
+        free(S);
     }
 }
 
-void execute_input(Parse *P){
-    signal(SIGCHLD, handler);
-    size_t size;
-    Task T;
+static void *stage_writer(void *arg){
+    Stage *S = arg;
+    /* a reader that went away is EPIPE, SIGPIPE being ignored */
+    write_all(S->fd, S->buf, S->len);
+    close(S->fd);
+    stage_put(S);
+    return NULL;
+}
+
+/* runs S's builtin into memory and starts the thread writing it to fd */
+static int stage_thread(Stage *S, int fd){
+    FILE *mem = open_memstream(&S->buf, &S->len);
+    if(!mem)
+        return -1;
+    S->status = S->B->fn(S->B, S->T, mem);
+    fclose(mem);
+    S->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    S->refs = 2;
+    if(pthread_create(&S->tid, NULL, stage_writer, S)){
+        close(S->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* child side of a forked builtin stage */
+static int stage_run(void *arg){
+    Stage *S = arg;
+    int status;
+    /* not the shell: anything it starts stays in the pipeline's group */
+    interactive = 0;
+    event_reinit();
+    status = S->B->fn(S->B, S->T, stdout);
+    fflush(stdout);
+    return status;
+}
+
+/* Called for a pipeline (or any external command).  Launches every
+ * stage, connected by pipes, and either waits for the job or leaves it
+ * in the background.  Returns the exit status of the last stage. */
+int execute_input(Plan *L){
+    Parse *P = L->P;
+    const Limits *lim = L->limited ? &L->lim : NULL;
+    const Pin *pin = L->pin;
+    const PipeOpts *po = &L->po;
+    const char* path[P->ntasks];
     int fd[P->ntasks][2];
     pid_t pid[P->ntasks];
+    Stage *stage[P->ntasks];
+    int tap[P->ntasks][2];
+    int *tapfd[P->ntasks];
+    int ntapfd[P->ntasks];
+    Job *J = NULL;
+    CGroup *G = NULL;
+    SpawnReq R;
+    struct timespec start;
+    uint64_t t0;
+    pid_t pgid = 0;
+    int in, out;
+    int tty = -1;
+    int n, nprocs = 0, status = 0;
+    bool stopped = false;
     void (*sav)(int sig);
-    pid_t *pidArr;
-    pidArr = malloc(P->ntasks * sizeof(pid_t));
-    for(int j = 0; j < (P->ntasks - 1); j++){
-        if (pipe(fd[j]) == -1) {
-            fprintf(stderr, "failed to create pipe\n");
-            return;
+
+    for(int k = 0; k < P->ntasks; k++){
+        stage[k] = NULL;
+        path[k] = L->paths[k];
+        if(!path[k]){
+            stage[k] = calloc(1, sizeof(Stage));
+            stage[k]->B = builtin_lookup(P->tasks[k].cmd);
+            stage[k]->T = P->tasks[k];
         }
     }
+    /* cd, fg, set and the like only mean something in the shell itself */
     for(int k = 0; k < P->ntasks; k++){
-        T = P->tasks[k];
-        if(!(command_found (T.cmd))) return;
-        pid[k] = vfork();
-        setpgid(pid[k], pid[0]);
-
-        if (pid[k] < 0){
-            printf("Failed to fork\n");
-            exit(EXIT_FAILURE);
+        if(stage[k] && !(stage[k]->B->flags & (BUILTIN_PURE | BUILTIN_FORKABLE))){
+            fprintf(stderr, "pssh: %s: cannot run in a pipeline\n", P->tasks[k].cmd);
+            for(int m = 0; m < P->ntasks; m++)
+                free(stage[m]);
+            return 1;
         }
-        if (pid[k] == 0){
-            if(getpgid(getpid()) == getpid() && !(P->background)){
-                sav = signal(SIGTTOU, SIG_IGN);
-                tcsetpgrp(STDOUT_FILENO, getpgrp());
-                signal(SIGTTOU, sav);
-            }
-            
-            if(k == 0){
-                ifile(P);
-            }
-            else if(dup2(fd[k-1][0], STDIN_FILENO) == -1) {
-                    fprintf(stderr, "dup2() failed!\n");
-                    exit(EXIT_FAILURE);
-            }
-            if(k == P->ntasks - 1){
-                ofile(P);
+    }
+    if(interactive && !(P->background) && isatty(STDIN_FILENO))
+        tty = STDIN_FILENO;
+
+    in = open_infile(P);
+    out = open_outfile(P);
+    if(in == -1 || out == -1){
+        if(in > STDIN_FILENO) close(in);
+        if(out > STDOUT_FILENO) close(out);
+        for(int m = 0; m < P->ntasks; m++)
+            free(stage[m]);
+        return 1;
+    }
+    for(int j = 0; j < (P->ntasks - 1); j++){
+        t0 = trace_now();
+        if (pipes_open(fd[j], po) == -1) {
+            fprintf(stderr, "failed to create pipe\n");
+            for(int m = 0; m < j; m++){
+                close(fd[m][0]);
+                close(fd[m][1]);
             }
-            else if(dup2(fd[k][1], STDOUT_FILENO) == -1) {
-                    fprintf(stderr, "dup2() failed!\n");
-                    exit(EXIT_FAILURE);
+            if(in != STDIN_FILENO) close(in);
+            if(out != STDOUT_FILENO) close(out);
+            for(int m = 0; m < P->ntasks; m++)
+                free(stage[m]);
+            return 1;
+        }
+        trace_span("pipe", t0, NULL);
+    }
+
+    if(open_taps(P, tap, tapfd, ntapfd, po) == -1){
+        for(int m = 0; m < P->ntasks-1; m++){
+            close(fd[m][0]);
+            close(fd[m][1]);
+        }
+        if(in != STDIN_FILENO) close(in);
+        if(out != STDOUT_FILENO) close(out);
+        for(int m = 0; m < P->ntasks; m++)
+            free(stage[m]);
+        return 1;
+    }
+
+    if(lim && !(G = cg_new(lim))){
+        close_taps(tap, tapfd, ntapfd, P->ntasks);
+        for(int m = 0; m < P->ntasks-1; m++){
+            close(fd[m][0]);
+            close(fd[m][1]);
+        }
+        if(in != STDIN_FILENO) close(in);
+        if(out != STDOUT_FILENO) close(out);
+        for(int m = 0; m < P->ntasks; m++)
+            free(stage[m]);
+        return 1;
+    }
+
+    /* a forked builtin must not inherit (and repeat) pending output */
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(n = 0; n < P->ntasks; n++){
+        R.path = path[n];
+        R.argv = P->tasks[n].argv;
+        R.in_fd = n == 0 ? in : fd[n-1][0];
+        R.out_fd = n == P->ntasks - 1 ? out : fd[n][1];
+        if(tap[n][1] != -1)
+            R.out_fd = tap[n][1];
+        R.pgid = !interactive ? -1 : pgid;
+        R.tty_fd = !pgid ? tty : -1;
+        R.cgroup_fd = G ? cg_procs_fd(G) : -1;
+        R.pin = pin;
+        R.pin_cpu = pin ? pin_stage_cpu(pin, n) : -1;
+        R.err_fd = open_errfile(&P->tasks[n]);
+        R.run = NULL;
+        R.arg = NULL;
+
+        pid[n] = 0;
+        if(R.err_fd == -1)
+            break;
+        if(stage[n] && (stage[n]->B->flags & BUILTIN_PURE)){
+            /* it runs in the shell, whose stderr it shares */
+            if(R.err_fd > STDERR_FILENO)
+                close(R.err_fd);
+            if(stage_thread(stage[n], R.out_fd) == -1){
+                fprintf(stderr, "pssh: %s: %s\n", P->tasks[n].cmd, strerror(errno));
+                free(stage[n]->buf);
+                break;
             }
-            for(int l = 0; l < P->ntasks-1; l++){
-                close(fd[l][0]);
-                close(fd[l][1]);
+            continue;
+        }
+        if(stage[n]){
+            R.run = stage_run;
+            R.arg = stage[n];
+        }
+
+        t0 = trace_now();
+        pid[n] = spawn(&R);
+        trace_span("spawn", t0, P->tasks[n].cmd);
+        if(R.err_fd > STDERR_FILENO)
+            close(R.err_fd);
+        if(pid[n] < 0){
+            fprintf(stderr, "pssh: %s: %s\n", P->tasks[n].cmd, strerror(errno));
+            break;
+        }
+        if(!pgid)
+            pgid = pid[n];
+        nprocs++;
+        /* also done by the child; whichever runs first wins the race */
+        if(interactive)
+            setpgid(pid[n], pgid);
+        if(pgid == pid[n] && tty != -1){
+            t0 = trace_now();
+            sav = signal(SIGTTOU, SIG_IGN);
+            tcsetpgrp(tty, pgid);
+            signal(SIGTTOU, sav);
+            trace_span("tcsetpgrp", t0, P->tasks[n].cmd);
+        }
+    }
+
+    /* nothing is reaped until the next event_poll(), so registering
+     * after the launch cannot miss an early exit */
+    if(nprocs){
+        J = job_new(L->name, nprocs);
+        J->cgroup = G;
+        for(int x = 0; x < n; x++)
+            if(pid[x] > 0)
+                job_add_proc(J, pid[x], P->tasks[x].cmd);
+        if(po->stats && P->ntasks > 1){
+            J->nedges = P->ntasks - 1;
+            J->edges = calloc(J->nedges, sizeof(Edge));
+            for(unsigned x = 0; x < J->nedges; x++){
+                J->edges[x].from = strdup(P->tasks[x].cmd);
+                J->edges[x].to = strdup(P->tasks[x+1].cmd);
             }
-            execvp(T.cmd, T.argv);
-            printf("Failed to exec\n");
-            exit(EXIT_FAILURE);
         }
     }
+    start_taps(P, tap, tapfd, ntapfd, fd, out, n, J);
+
     for(int m = 0; m < P->ntasks-1; m++){
         close(fd[m][0]);
         close(fd[m][1]);
     }
+    if(in != STDIN_FILENO) close(in);
+    if(out != STDOUT_FILENO) close(out);
+
+    if(!J)
+        cg_destroy(G);
+    if(n == 0 && !nprocs){
+        for(int m = 0; m < P->ntasks; m++)
+            free(stage[m]);
+        return 126;
+    }
+
+    if(J){
+        J->start = start;
+        J->timed = P->timed;
+        job_set_current(J);
+        if(!(P->background)){
+            J->status = FG;
+            J->isFG = true;
+            int id = J->id;
+            status = wait_foreground(J);
+            stopped = job_get(id) != NULL;
+        }
+        else if(interactive){
+            printf("[%d] ", J->id);
+            for(int x = 0; x < n; x++){
+                if(pid[x] > 0)
+                    printf("%d ",pid[x]);
+            }
+            printf("\n");
+        }
+    }
+
+    /* collect the in-shell stages: a finished foreground pipeline waits
+     * for their output to drain, anything else lets them run on */
     for(int x = 0; x < P->ntasks; x++){
-        pidArr[x] = pid[x];
-    }
-    jobArr[w]->pids = pidArr;
-    jobArr[w]->pgid = pid[0];
-    jobArr[w]->npids = P->ntasks;
-    jobArr[w]->status = BG;
-    jobArr[w]->isFG = false;
-    if(!(P->background)){
-        jobArr[w]->status = FG;
-        jobArr[w]->isFG = true;
-        pause();
-    }
-
-    if(P->background){
-        printf("[%d] ", w);
-        for(int x = 0; x < P->ntasks; x++){
-            printf("%d ",pid[x]);
+        Stage *S = stage[x];
+        if(!S)
+            continue;
+        if(x >= n || pid[x] || !S->refs){
+            free(S);
+            continue;
+        }
+        if(!(P->background) && !stopped){
+            pthread_join(S->tid, NULL);
+            if(x == P->ntasks - 1)
+                status = S->status;
         }
-        printf("\n");
+        else
+            pthread_detach(S->tid);
+        stage_put(S);
     }
 
+    return P->background ? 0 : status;
+}
+
+static double tv_diff(struct timeval *a, struct timeval *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_usec - a->tv_usec) / 1e6;
 }
 
-/* Called upon receiving a successful parse.
+/* `time` on a builtin: it runs inside the shell, so report the
+ * shell's own usage over the call */
+static void time_builtin(struct timespec *t0, struct rusage *r0)
+{
+    struct timespec t1;
+    struct rusage r1;
+    double real;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    getrusage(RUSAGE_SELF, &r1);
+    real = (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+
+    fprintf(stderr, "%-6s %-7s %9s %9s %9s %9s\n",
+            "stage", "pid", "real", "user", "sys", "maxrss");
+    fprintf(stderr, "%-6s %-7d %8.3fs %8.3fs %8.3fs %8ldK\n",
+            "total", getpid(), real,
+            tv_diff(&r0->ru_utime, &r1.ru_utime),
+            tv_diff(&r0->ru_stime, &r1.ru_stime), r1.ru_maxrss);
+}
+
+/* Called with the plan of a command line (see plan.c).
  * This function is responsible for cycling through the
  * tasks, and forking, executing, etc as necessary to get
- * the job done! */
-void execute_tasks (Parse *P)
+ * the job done!  Returns the exit status of the command line. */
+int execute_tasks (Plan *L)
 {
-    unsigned int t;
-    int check = 0;
-
-    for (t = 0; t < P->ntasks; t++) {
-        if (is_builtin (P->tasks[t].cmd)) {
-            if(P->infile != NULL || P->outfile != NULL){
-                pid_t pid;
-                pid = fork();
-                if(pid < 0){
-                    printf("Failed to fork\n");
-                    exit(EXIT_FAILURE);
-                }
-                if(pid > 0)
-                    wait(NULL);  
-                else{
-                    ifile(P);
-                    ofile(P);
-                    builtin_execute (P->tasks[t],jobArr);
-                    exit(EXIT_SUCCESS);
-                }
-            }
-            else
-                if(!strcmp("exit",P->tasks[t].cmd)){
-                    for(int y = 0; y < 100; y++){
-                        if(jobArr[y]){
-                            free(jobArr[y]->name);
-                            free(jobArr[y]->pids);
-                            free(jobArr[y]);
-                        }
-                    }
-                }
-                builtin_execute (P->tasks[t],jobArr);
-                if (getpgrp() != tcgetpgrp(STDIN_FILENO)) pause();
+    Parse *P = L->P;
+    const Builtin *B = L->B;
+    int status = 0;
+
+    if (B) {
+        struct timespec t0;
+        struct rusage r0;
+        int saved[3];
+
+        /* a lone builtin runs in the shell itself, redirections and all */
+        if(redirect_builtin(P, saved) == -1){
+            restore_std(saved);
+            return 1;
         }
-        else if (command_found (P->tasks[t].cmd)) {
-            if(check)continue;
-            w = 0;
-            while(jobArr[w]) w++;
-            Job *tempJob;
-            tempJob = malloc(sizeof(Job));
-            jobArr[w] = tempJob;
-            char name[2048] = "";
-            int e;
-            for(int p = 0; p < P->ntasks; p++){
-                e = 0;
-                while(P->tasks[p].argv[e]){
-                    strcat(name,P->tasks[p].argv[e]);
-                    strcat(name," ");
-                    e++;
-                }
-                if(p + 1 == P->ntasks) break;
-                strcat(name,"| ");
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        getrusage(RUSAGE_SELF, &r0);
+        status = B->fn (B, P->tasks[0], stdout);
+        restore_std(saved);
+        if(P->timed)
+            time_builtin(&t0, &r0);
+        /* fg hands a job the terminal; wait for it like any other */
+        for(Job *J = job_next(NULL); J && (B->flags & BUILTIN_JOBCTL); J = job_next(J)){
+            if(J->isFG){
+                status = wait_foreground(J);
+                break;
             }
-            strcat(name,"\0");
-            char *copy = strdup(name);
-            memset(name, '\0', 2048);
-            jobArr[w]->name = copy;
-            execute_input(P);
-            check = 1;
         }
+        return status;
+    }
+
+    return execute_input(L);
+}
+
+
+static char* line_read;
+static int line_done;
+
+static void line_handler (char* line)
+{
+    line_read = line;
+    line_done = 1;
+
+    /* keeps readline from redrawing the prompt before the command runs */
+    rl_callback_handler_remove ();
+}
+
+
+static void on_terminal (int fd, unsigned int events, void* arg)
+{
+    rl_callback_read_char ();
+}
+
+
+/* a git segment came in while readline was showing the prompt */
+static void redraw_prompt ()
+{
+    if (!at_prompt || !prompt_update (last_status, job_count ()))
+        return;
+
+    rl_clear_visible_line ();
+    rl_set_prompt (prompt_text ());
+    rl_on_new_line ();
+    rl_redisplay ();
+}
+
+
+/* readline(), except that the event loop keeps running (and background
+ * jobs keep getting reaped) while waiting for the user */
+static char* read_line (const char* prompt)
+{
+    int watched;
+
+    line_done = 0;
+    rl_callback_handler_install (prompt, line_handler);
+
+    watched = !event_watch (STDIN_FILENO, EPOLLIN, on_terminal, NULL);
+
+    at_prompt = 1;
+    while (!line_done) {
+        if (watched)
+            event_poll (-1);
         else {
-            printf ("pssh: command not found: %s\n", P->tasks[t].cmd);
-            break;
+            /* epoll refuses regular files, which are always readable */
+            rl_callback_read_char ();
+            event_poll (0);
         }
     }
+    at_prompt = 0;
+
+    if (watched)
+        event_unwatch (STDIN_FILENO);
+
+    return line_read;
 }
 
 
-int main (int argc, char** argv)
+/* $PSSH_HISTFILE, or ~/.pssh_history */
+static void open_history ()
 {
-    signal(SIGTTOU, sighandler);
-    signal(SIGTTIN, sighandler);
-    signal(SIGSTOP, sighandler);
-    char* cmdline;
+    const char* home = getenv ("HOME");
+    const char* file = getenv ("PSSH_HISTFILE");
+    char path[PATH_MAX];
+
+    if (!file) {
+        if (!home)
+            return;
+        snprintf (path, sizeof(path), "%s/.pssh_history", home);
+        file = path;
+    }
+
+    if (hist_open (file) == -1)
+        fprintf (stderr, "pssh: %s: %s\n", file, strerror (errno));
+}
+
+
+/* Exits other than at the prompt.  The `|>` taps and instrumented pipes
+ * of background jobs are relayed by the shell itself, so they are
+ * drained first: exiting would cut their output short */
+static void finish (int status)
+{
+    while (mover_busy (0))
+        event_poll (-1);
+    exit (status);
+}
+
+
+/* parses and runs one command line, updating last_status */
+static void run_line (char* cmdline)
+{
+    uint64_t t0;
     Parse* P;
+    Plan *L, *R;
 
-    print_banner ();
-    char *path;
-    path = build_prompt();
+    /* a line run before goes straight to execute_tasks() */
+    if ((L = plan_lookup (cmdline)))
+        goto run;
+
+    t0 = trace_now ();
+    P = parse_cmdline (cmdline);
+    trace_span ("parse", t0, cmdline);
+    if (!P)
+        return;
+
+    if (P->invalid_syntax) {
+        printf ("pssh: invalid syntax\n");
+        last_status = 2;
+        parse_destroy (&P);
+        /* a script that cannot be parsed is not worth continuing */
+        if (!interactive)
+            finish (last_status);
+        return;
+    }
+
+#if DEBUG_PARSE
+    parse_debug (P);
+#endif
+
+    /* `time` on its own times nothing, as in bash */
+    if (!P->ntasks) {
+        struct timespec t0;
+        struct rusage r0;
+        clock_gettime (CLOCK_MONOTONIC, &t0);
+        getrusage (RUSAGE_SELF, &r0);
+        time_builtin (&t0, &r0);
+        parse_destroy (&P);
+        last_status = 0;
+        return;
+    }
+
+    if (!(L = plan_compile (cmdline, P, &last_status))) {
+        if (opt_errexit)
+            finish (last_status);
+        return;
+    }
+
+run:
+    if ((R = plan_instance (L, &last_status))) {
+        last_status = execute_tasks (R);
+        plan_release (R);
+    }
+
+    /* the trace is written out between lines, not while one runs */
+    trace_flush (0);
+
+    if (opt_errexit && last_status)
+        finish (last_status);
+}
+
+
+/* runs every line of a non-interactive source in turn; finished
+ * background jobs are reaped between lines */
+static void run_text (char* text, size_t len)
+{
+    char *line, *nl, *end = text + len;
+
+    for (line=text; line<end; line=nl+1) {
+        nl = memchr (line, '\n', end - line);
+        if (!nl)
+            nl = end;
+        *nl = '\0';
+        run_line (line);
+        event_poll (0);
+    }
+}
+
+
+/* runs a script from fd, reading it in large blocks and handing the
+ * complete lines of each block to run_text() */
+static void run_fd (int fd)
+{
+    size_t cap = SCRIPT_BLOCK, len = 0, keep;
+    char *buf = malloc (cap + 1);
+    char *nl;
+    ssize_t n;
 
     while (1) {
-        cmdline = readline (path);
-        if (!cmdline)       /* EOF (ex: ctrl-d) */
-            exit (EXIT_SUCCESS);
+        n = read (fd, buf + len, cap - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+
+        nl = memrchr (buf, '\n', len);
+        if (!nl) {
+            /* a line longer than the buffer */
+            if (len == cap)
+                buf = realloc (buf, (cap *= 2) + 1);
+            continue;
+        }
+
+        keep = len - (nl + 1 - buf);
+        run_text (buf, nl - buf);
+        memmove (buf, nl + 1, keep);
+        len = keep;
+    }
+
+    if (len)
+        run_text (buf, len);
+
+    free (buf);
+}
 
-        P = parse_cmdline (cmdline);
-        if (!P)
-            goto next;
 
-        if (P->invalid_syntax) {
-            printf ("pssh: invalid syntax\n");
-            goto next;
+static void usage ()
+{
+    fprintf (stderr, "usage: pssh [--spawn=fork|vfork|posix_spawn|helper] "
+                     "[--trace=file] [-e] [-c command | script]\n");
+    exit (EXIT_FAILURE);
+}
+
+
+int main (int argc, char** argv)
+{
+    char* command = NULL;
+    char* script = NULL;
+    int i, fd;
+
+    for (i=1; i<argc; i++) {
+        if (!strncmp (argv[i], "--spawn=", 8)) {
+            if (spawn_set_backend (argv[i] + 8))
+                usage ();
+        } else if (!strncmp (argv[i], "--trace=", 8)) {
+            if (trace_start (argv[i] + 8) == -1) {
+                fprintf (stderr, "pssh: %s: %s\n", argv[i] + 8, strerror (errno));
+                exit (EXIT_FAILURE);
+            }
+        } else if (!strcmp (argv[i], "-e"))
+            opt_errexit = 1;
+        else if (!strcmp (argv[i], "-c")) {
+            if (++i == argc)
+                usage ();
+            command = argv[i];
+            break;
+        } else if (argv[i][0] == '-')
+            usage ();
+        else {
+            script = argv[i];
+            break;
         }
+    }
 
-#if DEBUG_PARSE
-        parse_debug (P);
-#endif
+    builtin_init ();
+
+    /* before the shell has anything in it for the helper to copy */
+    if (spawn_backend == SPAWN_HELPER && spawn_helper_start () == -1) {
+        fprintf (stderr, "pssh: failed to start spawn helper: %s\n", strerror (errno));
+        spawn_backend = SPAWN_POSIX_SPAWN;
+    }
 
-        execute_tasks (P);
+    interactive = !command && !script && isatty (STDIN_FILENO);
 
-    next:
-        parse_destroy (&P);
+    if (interactive) {
+        signal(SIGTTOU, sighandler);
+        signal(SIGTTIN, sighandler);
+        signal(SIGSTOP, sighandler);
+    }
+    /* a |> tap whose reader went away gets EPIPE instead */
+    signal(SIGPIPE, SIG_IGN);
+    if (event_init (reap_children) == -1) {
+        fprintf (stderr, "pssh: failed to set up event loop\n");
+        exit (EXIT_FAILURE);
+    }
+
+    if (command) {
+        run_text (command, strlen (command));
+        finish (last_status);
+    }
+
+    if (script || !interactive) {
+        fd = STDIN_FILENO;
+        if (script && (fd = open (script, O_RDONLY | O_CLOEXEC)) == -1) {
+            fprintf (stderr, "pssh: %s: %s\n", script, strerror (errno));
+            exit (127);
+        }
+        run_fd (fd);
+        finish (last_status);
+    }
+
+    char* cmdline;
+
+    open_history ();
+    complete_init ();
+    prompt_init (redraw_prompt);
+    print_banner ();
+
+    while (1) {
+        prompt_update (last_status, job_count ());
+        cmdline = read_line (prompt_text ());
+        if (!cmdline)       /* EOF (ex: ctrl-d) */
+            exit (last_status);
+
+        hist_add (cmdline);
+        run_line (cmdline);
         free(cmdline);
+
+        /* whatever ran may have changed the work tree */
+        prompt_vcs_refresh ();
     }
-    free(path);
 }
@@ -0,0 +1,514 @@
+/* Process launch backends.
+ *
+ * Each pipeline stage is described by a SpawnReq and launched by one of:
+ *
+ *   posix_spawn - the default.  Process group, terminal ownership and
+ *                 stdin/stdout are expressed as spawn attributes and file
+ *                 actions; glibc runs them in a CLONE_VM|CLONE_VFORK
+ *                 child, so launch cost does not grow with the shell's RSS
+ *   vfork       - same setup done by hand in a vfork child, restricted to
+ *                 async-signal-safe calls
+ *   fork        - same as vfork, but with a full copy of the shell
+ *   helper      - a small process forked when the shell starts, before
+ *                 it has grown, does the fork for the shell (see below)
+ *
+ * The backend is picked with `pssh --spawn=fork|vfork|posix_spawn|helper`.
+ * A request that runs a function in the child (a builtin as a pipeline
+ * stage) has nothing to exec, so it always takes the fork path, and one
+ * that joins a cgroup or is pinned is done with vfork in place of
+ * posix_spawn.
+ *
+ * The spawn helper is sent each request over a SOCK_SEQPACKET socket:
+ * the path, argv and environment, and (as SCM_RIGHTS) the working
+ * directory, the three standard descriptors, the terminal and the
+ * cgroup.  It forks with clone(CLONE_PARENT), which makes the child the
+ * shell's own, not the helper's, so job control, setpgid() and wait4()
+ * work as for any other backend; the helper answers with the pid.  What
+ * the fork copies is the helper, whatever the size of the shell's heap,
+ * readline and history.  Should the helper go away, the shell carries on
+ * with posix_spawn.
+ **********************************************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "spawn.h"
+
+/* cwd, stdin, stdout, stderr, terminal, cgroup */
+#define HELPER_FDS 6
+
+/* A request to the spawn helper, followed by the path, argv and the
+ * environment as NUL terminated strings.  pin is only sent if pinned */
+typedef struct {
+    pid_t pgid;          /* resolved: never -1 */
+    int err2out;         /* stderr follows stdout: no descriptor for it */
+    int tty;             /* a terminal descriptor is sent */
+    int cgroup;          /* a cgroup.procs descriptor is sent */
+    int nargv;
+    int nenv;
+    int pin_cpu;
+    int pinned;
+    Pin pin;
+} HelperReq;
+
+extern char** environ;
+
+SpawnBackend spawn_backend = SPAWN_POSIX_SPAWN;
+
+static const char* backend_names[] = {
+    "fork",
+    "vfork",
+    "posix_spawn",
+    "helper",
+    NULL
+};
+
+static int helper_fd = -1;
+
+/* signals the shell may catch or ignore that children expect defaulted */
+static const int default_sigs[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE, 0
+};
+
+
+int spawn_set_backend (const char* name)
+{
+    int i;
+
+    for (i=0; backend_names[i]; i++) {
+        if (!strcmp (name, backend_names[i])) {
+            spawn_backend = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+const char* spawn_backend_name ()
+{
+    return backend_names[spawn_backend];
+}
+
+
+static void write_str (const char* s)
+{
+    ssize_t unused = write (STDERR_FILENO, s, strlen (s));
+    (void) unused;
+}
+
+
+/* what exec() would have done to the shell's descriptors: a builtin
+ * run in a child must not hold pipe ends open that its neighbours are
+ * waiting to see closed */
+static void close_cloexec ()
+{
+    struct dirent* de;
+    DIR* D = opendir ("/proc/self/fd");
+    int fd, flags;
+
+    if (!D)
+        return;
+
+    while ((de = readdir (D))) {
+        fd = atoi (de->d_name);
+        if (fd <= STDERR_FILENO || fd == dirfd (D))
+            continue;
+        flags = fcntl (fd, F_GETFD);
+        if (flags != -1 && (flags & FD_CLOEXEC))
+            close (fd);
+    }
+
+    closedir (D);
+}
+
+
+/* Runs in the child of fork() or vfork(), so only async-signal-safe
+ * calls are allowed (up to R->run, which only ever follows a fork())
+ * and it must never return */
+static void child_exec (SpawnReq* R)
+{
+    struct sigaction dfl;
+    sigset_t set;
+    int i;
+
+    /* before anything runs that could fork outside of it */
+    if (R->cgroup_fd != -1 && write (R->cgroup_fd, "0", 1) == -1) {
+        write_str ("pssh: failed to join cgroup\n");
+        _exit (126);
+    }
+
+    if (R->pin)
+        pin_apply (R->pin, R->pin_cpu);
+
+    if (R->pgid != -1)
+        setpgid (0, R->pgid);
+
+    /* all signals are still blocked here, so taking the
+     * terminal from the background does not raise SIGTTOU */
+    if (R->tty_fd != -1)
+        tcsetpgrp (R->tty_fd, getpgrp ());
+
+    memset (&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    for (i=0; default_sigs[i]; i++)
+        sigaction (default_sigs[i], &dfl, NULL);
+
+    sigemptyset (&set);
+    sigprocmask (SIG_SETMASK, &set, NULL);
+
+    if (R->in_fd != STDIN_FILENO && dup2 (R->in_fd, STDIN_FILENO) == -1)
+        _exit (127);
+
+    if (R->out_fd != STDOUT_FILENO && dup2 (R->out_fd, STDOUT_FILENO) == -1)
+        _exit (127);
+
+    if (R->err_fd != STDERR_FILENO && dup2 (R->err_fd, STDERR_FILENO) == -1)
+        _exit (127);
+
+    if (R->run) {
+        close_cloexec ();
+        _exit (R->run (R->arg));
+    }
+
+    execv (R->path, R->argv);
+
+    write_str ("pssh: failed to exec ");
+    write_str (R->path);
+    write_str ("\n");
+    _exit (127);
+}
+
+
+static pid_t spawn_fork (SpawnReq* R, int use_vfork)
+{
+    sigset_t all, old;
+    pid_t pid;
+    int err;
+
+    /* keep the shell's handlers from running in the child */
+    sigfillset (&all);
+    sigprocmask (SIG_SETMASK, &all, &old);
+
+    pid = use_vfork ? vfork () : fork ();
+    if (pid == 0)
+        child_exec (R);
+
+    err = errno;
+    sigprocmask (SIG_SETMASK, &old, NULL);
+    errno = err;
+
+    return pid;
+}
+
+
+static pid_t spawn_posix (SpawnReq* R)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t set;
+    pid_t pid;
+    short flags;
+    int err, i;
+
+    posix_spawn_file_actions_init (&fa);
+    posix_spawnattr_init (&attr);
+
+    flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    if (R->pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup (&attr, R->pgid);
+    }
+    posix_spawnattr_setflags (&attr, flags);
+
+    sigemptyset (&set);
+    posix_spawnattr_setsigmask (&attr, &set);
+
+    for (i=0; default_sigs[i]; i++)
+        sigaddset (&set, default_sigs[i]);
+    posix_spawnattr_setsigdefault (&attr, &set);
+
+    /* must precede the dup2()s: tty_fd may be the stdin being replaced */
+    if (R->tty_fd != -1)
+        posix_spawn_file_actions_addtcsetpgrp_np (&fa, R->tty_fd);
+
+    if (R->in_fd != STDIN_FILENO)
+        posix_spawn_file_actions_adddup2 (&fa, R->in_fd, STDIN_FILENO);
+
+    if (R->out_fd != STDOUT_FILENO)
+        posix_spawn_file_actions_adddup2 (&fa, R->out_fd, STDOUT_FILENO);
+
+    if (R->err_fd != STDERR_FILENO)
+        posix_spawn_file_actions_adddup2 (&fa, R->err_fd, STDERR_FILENO);
+
+    err = posix_spawn (&pid, R->path, &fa, &attr, R->argv, environ);
+
+    posix_spawn_file_actions_destroy (&fa);
+    posix_spawnattr_destroy (&attr);
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/* Runs in the helper: waits for requests and forks them as the shell's
+ * children, until the shell closes its end */
+static void helper_main (int sock)
+{
+    union {
+        char buf[CMSG_SPACE (HELPER_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cm;
+    sigset_t all;
+    HelperReq* H;
+    SpawnReq R;
+    char *buf, *s, **argv, **env;
+    int fds[HELPER_FDS], nfds, f, i;
+    ssize_t len;
+    pid_t pid;
+
+    prctl (PR_SET_PDEATHSIG, SIGKILL);
+
+    /* out of the shell's group, so ^C and ^Z are not meant for it; the
+     * children it forks see to their own signals (see child_exec()) */
+    setpgid (0, 0);
+    sigfillset (&all);
+    sigprocmask (SIG_SETMASK, &all, NULL);
+
+    for (;;) {
+        len = recv (sock, NULL, 0, MSG_PEEK | MSG_TRUNC);
+        if (len < (ssize_t)offsetof (HelperReq, pin)) {
+            if (len == -1 && errno == EINTR)
+                continue;
+            _exit (0);
+        }
+
+        buf = malloc (len + 1);
+        iov.iov_base = buf;
+        iov.iov_len = len;
+        memset (&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = u.buf;
+        msg.msg_controllen = sizeof(u.buf);
+        if (recvmsg (sock, &msg, MSG_CMSG_CLOEXEC) != len)
+            _exit (0);
+        buf[len] = '\0';
+
+        nfds = 0;
+        for (cm=CMSG_FIRSTHDR (&msg); cm; cm=CMSG_NXTHDR (&msg, cm))
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                nfds = (cm->cmsg_len - CMSG_LEN (0)) / sizeof(int);
+                memcpy (fds, CMSG_DATA (cm), nfds * sizeof(int));
+            }
+
+        H = (HelperReq*)buf;
+        s = buf + offsetof (HelperReq, pin) + (H->pinned ? sizeof(Pin) : 0);
+        argv = malloc ((H->nargv + 1) * sizeof(*argv));
+        env = malloc ((H->nenv + 1) * sizeof(*env));
+
+        R.path = s;
+        s += strlen (s) + 1;
+        for (i=0; i<H->nargv; i++, s+=strlen (s)+1)
+            argv[i] = s;
+        argv[i] = NULL;
+        for (i=0; i<H->nenv; i++, s+=strlen (s)+1)
+            env[i] = s;
+        env[i] = NULL;
+
+        f = 1;
+        R.argv = argv;
+        R.in_fd = fds[f++];
+        R.out_fd = fds[f++];
+        R.err_fd = H->err2out ? STDOUT_FILENO : fds[f++];
+        R.tty_fd = H->tty ? fds[f++] : -1;
+        R.cgroup_fd = H->cgroup ? fds[f++] : -1;
+        R.pgid = H->pgid;
+        R.pin = H->pinned ? &H->pin : NULL;
+        R.pin_cpu = H->pin_cpu;
+        R.run = NULL;
+        R.arg = NULL;
+
+        if (f != nfds) {
+            pid = -EINVAL;
+        } else {
+            /* a fork() whose child goes to the shell */
+            pid = syscall (SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+            if (pid == 0) {
+                environ = env;
+                if (fchdir (fds[0]) == -1)
+                    _exit (126);
+                child_exec (&R);
+            }
+            if (pid == -1)
+                pid = -errno;
+        }
+
+        for (i=0; i<nfds; i++)
+            close (fds[i]);
+        free (argv);
+        free (env);
+        free (buf);
+
+        if (send (sock, &pid, sizeof(pid), MSG_NOSIGNAL) != sizeof(pid))
+            _exit (0);
+    }
+}
+
+
+/* Forks the spawn helper.  Called early, while the shell is small: the
+ * helper keeps the memory it was forked with for good */
+int spawn_helper_start ()
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+
+    if ((pid = fork ()) == -1) {
+        close (sv[0]);
+        close (sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close (sv[0]);
+        helper_main (sv[1]);
+    }
+
+    close (sv[1]);
+    helper_fd = sv[0];
+
+    return 0;
+}
+
+
+static pid_t spawn_helper (SpawnReq* R)
+{
+    union {
+        char buf[CMSG_SPACE (HELPER_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } u;
+    struct msghdr msg;
+    struct iovec iov[2];
+    struct cmsghdr* cm;
+    HelperReq H;
+    char *strings, *s;
+    int fds[HELPER_FDS], nfds = 0;
+    size_t len;
+    ssize_t sent;
+    pid_t pid;
+    int i;
+
+    if ((fds[nfds++] = open (".", O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return -1;
+    fds[nfds++] = R->in_fd;
+    fds[nfds++] = R->out_fd;
+
+    memset (&H, 0, offsetof (HelperReq, pin));
+    H.pgid = R->pgid == -1 ? getpgrp () : R->pgid;
+    H.err2out = R->err_fd == STDOUT_FILENO;
+    if (!H.err2out)
+        fds[nfds++] = R->err_fd;
+    if ((H.tty = R->tty_fd != -1))
+        fds[nfds++] = R->tty_fd;
+    if ((H.cgroup = R->cgroup_fd != -1))
+        fds[nfds++] = R->cgroup_fd;
+    if ((H.pinned = R->pin != NULL))
+        H.pin = *R->pin;
+    H.pin_cpu = R->pin_cpu;
+
+    len = strlen (R->path) + 1;
+    for (H.nargv=0; R->argv[H.nargv]; H.nargv++)
+        len += strlen (R->argv[H.nargv]) + 1;
+    for (H.nenv=0; environ[H.nenv]; H.nenv++)
+        len += strlen (environ[H.nenv]) + 1;
+
+    s = strings = malloc (len);
+    s = stpcpy (s, R->path) + 1;
+    for (i=0; i<H.nargv; i++)
+        s = stpcpy (s, R->argv[i]) + 1;
+    for (i=0; i<H.nenv; i++)
+        s = stpcpy (s, environ[i]) + 1;
+
+    iov[0].iov_base = &H;
+    iov[0].iov_len = offsetof (HelperReq, pin) + (H.pinned ? sizeof(Pin) : 0);
+    iov[1].iov_base = strings;
+    iov[1].iov_len = len;
+
+    memset (&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = u.buf;
+    msg.msg_controllen = CMSG_SPACE (nfds * sizeof(int));
+    cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN (nfds * sizeof(int));
+    memcpy (CMSG_DATA (cm), fds, nfds * sizeof(int));
+
+    sent = sendmsg (helper_fd, &msg, MSG_NOSIGNAL);
+    close (fds[0]);
+    free (strings);
+
+    if (sent == -1 && errno != EPIPE && errno != ECONNRESET)
+        return -1;
+    if (sent == -1 || recv (helper_fd, &pid, sizeof(pid), 0) != sizeof(pid)) {
+        fprintf (stderr, "pssh: spawn helper has gone, using posix_spawn\n");
+        close (helper_fd);
+        helper_fd = -1;
+        spawn_backend = SPAWN_POSIX_SPAWN;
+        return spawn (R);
+    }
+
+    if (pid < 0) {
+        errno = -pid;
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/* launches R with the selected backend; returns the child's pid, or
+ * -1 with errno set if it could not be started */
+pid_t spawn (SpawnReq* R)
+{
+    if (R->run)
+        return spawn_fork (R, 0);
+
+    /* glibc's posix_spawn() can neither place a child in a cgroup nor
+     * set its affinity, nice value or I/O priority */
+    if ((R->cgroup_fd != -1 || R->pin) && spawn_backend == SPAWN_POSIX_SPAWN)
+        return spawn_fork (R, 1);
+
+    switch (spawn_backend) {
+    case SPAWN_FORK:
+        return spawn_fork (R, 0);
+    case SPAWN_VFORK:
+        return spawn_fork (R, 1);
+    case SPAWN_HELPER:
+        return spawn_helper (R);
+    default:
+        return spawn_posix (R);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _spawn_h_
+#define _spawn_h_
+
+#include <sys/types.h>
+
+#include "pin.h"
+
+typedef enum {
+    SPAWN_FORK,
+    SPAWN_VFORK,
+    SPAWN_POSIX_SPAWN,
+    SPAWN_HELPER,
+} SpawnBackend;
+
+/* Everything a pipeline stage needs set up between fork and exec.
+ * All other descriptors the shell holds are expected to be O_CLOEXEC */
+typedef struct {
+    const char* path;    /* resolved executable */
+    char** argv;         /* NULL terminated array of strings */
+    int in_fd;           /* becomes stdin  (STDIN_FILENO to inherit)  */
+    int out_fd;          /* becomes stdout (STDOUT_FILENO to inherit) */
+    int err_fd;          /* becomes stderr (STDERR_FILENO to inherit);
+                            STDOUT_FILENO follows out_fd */
+    pid_t pgid;          /* group to join (0: lead a new one, -1: keep the shell's) */
+    int tty_fd;          /* terminal to hand to the group, or -1 */
+    int cgroup_fd;       /* cgroup.procs of the cgroup to join, or -1 */
+    const Pin* pin;      /* placement from `pin`, or NULL */
+    int pin_cpu;         /* the one CPU for this stage, or -1 */
+    int (*run) (void* arg);  /* if set, called in a fork()ed child instead
+                                of exec()ing path; returns the exit status */
+    void* arg;
+} SpawnReq;
+
+extern SpawnBackend spawn_backend;
+
+int spawn_set_backend (const char* name);
+const char* spawn_backend_name (void);
+int spawn_helper_start (void);
+pid_t spawn (SpawnReq* R);
+
+#endif /* _spawn_h_ */
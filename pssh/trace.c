@@ -0,0 +1,278 @@
+/* Tracing.
+ *
+ * Events are recorded into a ring of TRACE_RING slots without taking a
+ * lock: a writer claims the next slot with an atomic add, fills it in
+ * and publishes it by storing its sequence number last, so any thread
+ * can record as well as the shell's.  Only
+ * the shell writes the ring out, between command lines once it is half
+ * full (or when tracing stops, or the shell exits), so a command that
+ * is being traced does not wait on the trace file.  Slots a writer got
+ * to before they were written out are counted as dropped; a slot being
+ * rewritten while it is read is caught by reading its sequence number
+ * again afterwards.
+ *
+ * The file is a JSON array of trace events, which both Perfetto and
+ * chrome://tracing load even if the shell died before closing it.
+ * Times are microseconds from the start of the trace.
+ **********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* events held between flushes; a power of two */
+#define TRACE_RING 16384
+
+typedef struct {
+    unsigned long seq;   /* its index + 1 once written, 0 while being written */
+    uint64_t ts, dur;    /* ns */
+    const char* name;
+    int pid, tid;
+    char ph;             /* X span, i instant, B/E begin/end, M name */
+    char arg[TRACE_ARG];
+} TraceEvent;
+
+int tracing;
+
+static TraceEvent ring[TRACE_RING];
+static unsigned long head;   /* next slot to claim */
+static unsigned long tail;   /* next slot to write out */
+static unsigned long nwritten, ndropped;
+static uint64_t base;
+static FILE* out;
+static char* out_path;
+static pid_t owner;
+
+
+static uint64_t clock_ns ()
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* now, or 0 if not tracing */
+uint64_t trace_now ()
+{
+    return tracing ? clock_ns () : 0;
+}
+
+
+static void emit (char ph, const char* name, int pid, int tid, uint64_t ts,
+                  uint64_t dur, const char* arg)
+{
+    unsigned long i = __atomic_fetch_add (&head, 1, __ATOMIC_RELAXED);
+    TraceEvent* E = &ring[i & (TRACE_RING - 1)];
+    size_t n = 0;
+
+    __atomic_store_n (&E->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    E->ph = ph;
+    E->name = name;
+    E->pid = pid;
+    E->tid = tid;
+    E->ts = ts;
+    E->dur = dur;
+
+    if (arg) {
+        n = strnlen (arg, TRACE_ARG);
+        memcpy (E->arg, arg, n);
+        /* cut short: not in the middle of a UTF-8 sequence */
+        if (n == TRACE_ARG)
+            for (n--; n && ((unsigned char)arg[n] & 0xc0) == 0x80; n--);
+    }
+    E->arg[n] = '\0';
+
+    __atomic_store_n (&E->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+
+static void put_string (const char* s)
+{
+    fputc ('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf (out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf (out, "\\u%04x", *s);
+        else
+            fputc (*s, out);
+    }
+    fputc ('"', out);
+}
+
+
+static void write_event (const TraceEvent* E)
+{
+    fprintf (out, "%s{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\"",
+             nwritten++ ? ",\n" : "", E->ph, E->pid, E->tid, E->name);
+
+    if (E->ph == 'M') {
+        fputs (",\"args\":{\"name\":", out);
+        put_string (E->arg);
+        fputs ("}}", out);
+        return;
+    }
+
+    fprintf (out, ",\"ts\":%.3f", (E->ts - base) / 1e3);
+    if (E->ph == 'X')
+        fprintf (out, ",\"dur\":%.3f", E->dur / 1e3);
+    if (E->ph == 'i')
+        fputs (",\"s\":\"t\"", out);
+    if (*E->arg) {
+        fputs (",\"args\":{\"detail\":", out);
+        put_string (E->arg);
+        fputc ('}', out);
+    }
+    fputc ('}', out);
+}
+
+
+/* Writes out what has been recorded, if force or once the ring is half
+ * full.  Only ever done by the shell, never by a child forked from it */
+void trace_flush (int force)
+{
+    unsigned long seq, now;
+    TraceEvent E, *S;
+
+    if (!out || getpid () != owner)
+        return;
+
+    now = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    if (!force && now - tail < TRACE_RING / 2)
+        return;
+
+    while (tail != now) {
+        if (now - tail > TRACE_RING) {
+            ndropped += now - TRACE_RING - tail;
+            tail = now - TRACE_RING;
+        }
+        S = &ring[tail & (TRACE_RING - 1)];
+        seq = __atomic_load_n (&S->seq, __ATOMIC_ACQUIRE);
+        /* still being written: left for the next flush */
+        if (seq < tail + 1)
+            break;
+        if (seq == tail + 1) {
+            E = *S;
+            __atomic_thread_fence (__ATOMIC_ACQUIRE);
+            if (__atomic_load_n (&S->seq, __ATOMIC_RELAXED) == seq) {
+                write_event (&E);
+                tail++;
+                continue;
+            }
+        }
+        /* written over since */
+        ndropped++;
+        tail++;
+    }
+
+    fflush (out);
+}
+
+
+static void trace_exit ()
+{
+    if (tracing && getpid () == owner)
+        trace_stop ();
+}
+
+
+/* starts writing a trace to path, ending any trace under way */
+int trace_start (const char* path)
+{
+    static int registered;
+    FILE* f;
+
+    if (!(f = fopen (path, "we")))
+        return -1;
+
+    trace_stop ();
+    out = f;
+    out_path = strdup (path);
+    owner = getpid ();
+    base = clock_ns ();
+    tail = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    nwritten = ndropped = 0;
+
+    if (!registered++)
+        atexit (trace_exit);
+
+    fputs ("[\n", out);
+    tracing = 1;
+    trace_track (owner, 0, "pssh");
+    trace_track (owner, owner, "shell");
+
+    return 0;
+}
+
+
+void trace_stop ()
+{
+    if (!out)
+        return;
+
+    tracing = 0;
+    trace_flush (1);
+    fputs ("\n]\n", out);
+    fclose (out);
+    out = NULL;
+    free (out_path);
+    out_path = NULL;
+}
+
+
+void trace_print (FILE* f)
+{
+    if (!out)
+        fprintf (f, "trace: off\n");
+    else
+        fprintf (f, "trace: on, to %s (%lu events written, %lu pending, %lu dropped)\n",
+                 out_path, nwritten, head - tail, ndropped);
+}
+
+
+/* a span of the shell's from t0 (a trace_now()) until now */
+void trace_span (const char* name, uint64_t t0, const char* arg)
+{
+    uint64_t now;
+
+    if (!tracing || !t0)
+        return;
+
+    now = clock_ns ();
+    emit ('X', name, owner, gettid (), t0, now - t0, arg);
+}
+
+
+void trace_instant (const char* name, const char* arg)
+{
+    if (tracing)
+        emit ('i', name, owner, gettid (), clock_ns (), 0, arg);
+}
+
+
+/* names a track (tid 0) or one of its rows */
+void trace_track (int track, int tid, const char* name)
+{
+    if (tracing)
+        emit ('M', tid ? "thread_name" : "process_name", track, tid, 0, 0, name);
+}
+
+
+void trace_begin (int track, int tid, const char* name)
+{
+    if (tracing)
+        emit ('B', name, track, tid, clock_ns (), 0, NULL);
+}
+
+
+void trace_end (int track, int tid, const char* arg)
+{
+    if (tracing)
+        emit ('E', "", track, tid, clock_ns (), 0, arg);
+}
@@ -0,0 +1,34 @@
+#ifndef _trace_h_
+#define _trace_h_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Tracing of what the shell does, written as Chrome trace JSON (for
+ * Perfetto or chrome://tracing).
+ *
+ * The shell's own work goes on its track as spans (trace_span(), from a
+ * trace_now() taken at the start) and instants.  Each job has a track
+ * of its own, keyed by its process group leader, with one row per
+ * process showing when it ran and when it was stopped.  Names must be
+ * string constants; args are copied, truncated to TRACE_ARG bytes.
+ * Everything is a no-op unless tracing. */
+
+#define TRACE_ARG 64
+
+extern int tracing;
+
+int trace_start (const char* path);
+void trace_stop (void);
+void trace_flush (int force);
+void trace_print (FILE* out);
+
+uint64_t trace_now (void);
+void trace_span (const char* name, uint64_t t0, const char* arg);
+void trace_instant (const char* name, const char* arg);
+
+void trace_track (int track, int tid, const char* name);
+void trace_begin (int track, int tid, const char* name);
+void trace_end (int track, int tid, const char* arg);
+
+#endif /* _trace_h_ */
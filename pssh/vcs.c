@@ -0,0 +1,257 @@
+/* Git status without git.
+ *
+ * The work tree is the nearest directory up from dir holding a .git,
+ * which is either the git directory itself or (worktrees, submodules)
+ * a file naming it.  The branch comes from its HEAD.
+ *
+ * "Dirty" is what git checks before hashing anything: a tracked file
+ * whose type, size or mtime no longer match the index entry recorded
+ * for it, or that is gone.  Untracked files and changes that are
+ * already staged are not looked for, and a file touched without being
+ * changed counts as dirty until git refreshes the index.  The index is
+ * read in versions 2 to 4; anything else leaves dirty unknown.
+ **********************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vcs.h"
+
+/* stat data, oid and flags: the fixed part of an index entry */
+#define ENTRY_FIXED 62
+
+/* entries walked between polls of cancel() */
+#define CANCEL_EVERY 1024
+
+#define CE_VALID        0x8000     /* assume-unchanged */
+#define CE_EXTENDED     0x4000
+#define CE_SKIP_WORKTREE 0x4000    /* in the extended flags */
+
+
+static uint32_t be32 (const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+
+/* finds the work tree containing dir: fills top with it and git with
+ * its git directory, or returns -1 */
+static int find_git (const char* dir, char* top, char* git)
+{
+    char buf[PATH_MAX], *slash, *nl;
+    struct stat st;
+    FILE* f;
+
+    if (strlen (dir) >= PATH_MAX - 8)
+        return -1;
+    strcpy (top, dir);
+
+    for (;;) {
+        snprintf (git, PATH_MAX, "%s/.git", strcmp (top, "/") ? top : "");
+        if (stat (git, &st) == 0) {
+            if (S_ISDIR (st.st_mode))
+                return 0;
+            if (S_ISREG (st.st_mode) && (f = fopen (git, "re"))) {
+                nl = fgets (buf, sizeof(buf), f);
+                fclose (f);
+                if (nl && !strncmp (buf, "gitdir: ", 8)) {
+                    if ((nl = strchr (buf, '\n')))
+                        *nl = '\0';
+                    if (buf[8] == '/')
+                        snprintf (git, PATH_MAX, "%s", buf + 8);
+                    else
+                        snprintf (git, PATH_MAX, "%s/%s", top, buf + 8);
+                    return 0;
+                }
+            }
+        }
+
+        if (!strcmp (top, "/") || !(slash = strrchr (top, '/')))
+            return -1;
+        slash[slash == top] = '\0';
+    }
+}
+
+
+static void read_head (const char* git, char* branch)
+{
+    char path[PATH_MAX + 8], buf[256], *nl;
+    FILE* f;
+
+    strcpy (branch, "?");
+    snprintf (path, sizeof(path), "%s/HEAD", git);
+    if (!(f = fopen (path, "re")))
+        return;
+    nl = fgets (buf, sizeof(buf), f);
+    fclose (f);
+    if (!nl)
+        return;
+    if ((nl = strchr (buf, '\n')))
+        *nl = '\0';
+
+    if (!strncmp (buf, "ref: refs/heads/", 16))
+        snprintf (branch, VCS_BRANCH_MAX, "%s", buf + 16);
+    else if (!strncmp (buf, "ref: ", 5))
+        snprintf (branch, VCS_BRANCH_MAX, "%s", buf + 5);
+    else
+        snprintf (branch, VCS_BRANCH_MAX, "%.7s", buf);
+}
+
+
+/* git's offset varint, as used for the v4 path prefix */
+static const unsigned char* varint (const unsigned char* p, const unsigned char* end,
+                                    size_t* val)
+{
+    unsigned char c;
+
+    if (p >= end)
+        return NULL;
+    c = *p++;
+    *val = c & 127;
+    while (c & 128) {
+        if (p >= end)
+            return NULL;
+        c = *p++;
+        *val = ((*val + 1) << 7) | (c & 127);
+    }
+
+    return p;
+}
+
+
+/* compares one index entry against the file it names under topfd */
+static int entry_changed (int topfd, const char* name, const unsigned char* e)
+{
+    uint32_t mode = be32 (e + 24);
+    uint32_t nsec = be32 (e + 12);
+    struct stat st;
+
+    /* a submodule: its own status is its own business */
+    if ((mode & S_IFMT) == 0160000)
+        return 0;
+
+    if (fstatat (topfd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+        return 1;
+
+    return (st.st_mode & S_IFMT) != (mode & S_IFMT) ||
+           (uint32_t)st.st_size != be32 (e + 36) ||
+           (uint32_t)st.st_mtim.tv_sec != be32 (e + 8) ||
+           /* 0 from a git built without sub-second times */
+           (nsec && (uint32_t)st.st_mtim.tv_nsec != nsec);
+}
+
+
+/* walks the index: 1 at the first changed file, 0 if none, -1 if the
+ * index cannot be read or the walk was cancelled */
+static int index_dirty (const char* top, const char* git,
+                        int (*cancel)(void*), void* arg)
+{
+    char path[PATH_MAX + 8], name[PATH_MAX];
+    const unsigned char *map, *p, *end, *s;
+    uint32_t version, n, i, flags;
+    size_t len, prev = 0, strip;
+    struct stat st;
+    int fd, topfd, dirty = -1;
+
+    snprintf (path, sizeof(path), "%s/index", git);
+    if ((fd = open (path, O_RDONLY | O_CLOEXEC)) == -1)
+        return errno == ENOENT ? 0 : -1;     /* nothing added yet */
+    if (fstat (fd, &st) == -1 || st.st_size < 12) {
+        close (fd);
+        return -1;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if ((topfd = open (top, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        goto out;
+
+    end = map + st.st_size;
+    version = be32 (map + 4);
+    n = be32 (map + 8);
+    if (memcmp (map, "DIRC", 4) || version < 2 || version > 4)
+        goto out;
+
+    p = map + 12;
+    for (i=0; i<n; i++) {
+        if (i % CANCEL_EVERY == 0 && cancel && cancel (arg))
+            goto out;
+        if (end - p < ENTRY_FIXED + 2)
+            goto out;
+
+        flags = p[60] << 8 | p[61];
+        s = p + ENTRY_FIXED;
+        if (version >= 3 && (flags & CE_EXTENDED)) {
+            if ((s[0] << 8 | s[1]) & CE_SKIP_WORKTREE)
+                flags |= CE_VALID;
+            s += 2;
+        }
+
+        if (version == 4) {
+            if (!(s = varint (s, end, &strip)) || strip > prev)
+                goto out;
+            len = strnlen ((const char*)s, end - s);
+            if (s + len == end || prev - strip + len >= sizeof(name))
+                goto out;
+            memcpy (name + prev - strip, s, len + 1);
+            prev = prev - strip + len;
+            s += len + 1;
+        } else {
+            len = strnlen ((const char*)s, end - s);
+            if (s + len == end || len >= sizeof(name))
+                goto out;
+            memcpy (name, s, len + 1);
+            /* entries are NUL padded to a multiple of 8 bytes */
+            s = p + ((s - p + len + 8) & ~7);
+        }
+
+        if (!(flags & CE_VALID) && entry_changed (topfd, name, p)) {
+            dirty = 1;
+            goto out;
+        }
+        p = s;
+    }
+    dirty = 0;
+
+out:
+    if (topfd != -1)
+        close (topfd);
+    munmap ((void*)map, st.st_size);
+    return dirty;
+}
+
+
+/* fills S with the branch checked out in the work tree containing dir,
+ * dirty unknown; returns -1 if dir is not in one */
+int vcs_branch (const char* dir, VcsStatus* S)
+{
+    char top[PATH_MAX], git[PATH_MAX];
+
+    if (find_git (dir, top, git) == -1)
+        return -1;
+
+    read_head (git, S->branch);
+    S->dirty = -1;
+
+    return 0;
+}
+
+
+/* 1 if a tracked file of the work tree containing dir has changed, 0
+ * if none has, -1 if that cannot be told (or cancel() said to stop) */
+int vcs_dirty (const char* dir, int (*cancel)(void*), void* arg)
+{
+    char top[PATH_MAX], git[PATH_MAX];
+
+    if (find_git (dir, top, git) == -1)
+        return -1;
+
+    return index_dirty (top, git, cancel, arg);
+}
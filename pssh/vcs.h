@@ -0,0 +1,22 @@
+#ifndef _vcs_h_
+#define _vcs_h_
+
+/* Git status for the prompt, read straight from .git without running
+ * git.
+ *
+ * vcs_branch() is a few stat()s.  vcs_dirty() may take a while on a big
+ * checkout (one lstat() per tracked file); cancel is polled during the
+ * walk and stops it early.  Neither touches anything but its arguments,
+ * so both are safe to call from a thread. */
+
+#define VCS_BRANCH_MAX 128
+
+typedef struct {
+    char branch[VCS_BRANCH_MAX];   /* or the abbreviated commit, detached */
+    int dirty;           /* 1 if a tracked file changed, -1 if not known */
+} VcsStatus;
+
+int vcs_branch (const char* dir, VcsStatus* S);
+int vcs_dirty (const char* dir, int (*cancel)(void*), void* arg);
+
+#endif /* _vcs_h_ */